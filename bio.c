@@ -17,6 +17,9 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_DELAY: the buffer holds file data whose disk block
+//     is not allocated yet; it is on its inode's list and
+//     never matches a bread().
 
 #include "types.h"
 #include "defs.h"
@@ -139,6 +142,52 @@ brelse(struct buf *b)
   
   release(&bcache.lock);
 }
+
+// Return a buffer tied to no disk block, for file data whose
+// block has not been allocated yet (see writei).  The buffer
+// is not locked; its owner's inode lock guards it.  It stays
+// out of circulation until bputanon().
+struct buf*
+bgetanon(void)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
+      b->dev = -1;  // matches no bget()
+      b->blockno = 0;
+      b->flags = B_VALID | B_DELAY;
+      b->refcnt = 1;
+      release(&bcache.lock);
+      return b;
+    }
+  }
+  panic("bgetanon: no buffers");
+}
+
+// Lock a buffer from bgetanon() for a caller that will
+// brelse() it, like a buffer from bread().
+void
+bholdanon(struct buf *b)
+{
+  acquire(&bcache.lock);
+  b->refcnt++;
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+}
+
+// Return a buffer from bgetanon() to the cache.
+void
+bputanon(struct buf *b)
+{
+  acquiresleep(&b->lock);
+  acquire(&bcache.lock);
+  b->dev = 0;
+  b->flags = 0;
+  release(&bcache.lock);
+  brelse(b);
+}
 //PAGEBREAK!
 // Blank page.
 
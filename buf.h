@@ -7,8 +7,11 @@ struct buf {
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
+  struct buf *dnext; // B_DELAY: owning inode's list, by lbn
+  uint lbn;          // B_DELAY: block number within the file
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_DELAY 0x8  // file data waiting for a disk block
 
@@ -4,11 +4,27 @@
 
 char buf[512];
 
+// Whether stdout can take splice(): a file, or a pipe (which
+// fstat cannot describe).
+int
+splicable(void)
+{
+  struct stat st;
+
+  return fstat(1, &st) < 0 || st.type == T_FILE;
+}
+
 void
 cat(int fd)
 {
   int n;
 
+  if(splicable()){
+    while((n = splice(fd, 1, sizeof(buf) * 64)) > 0)
+      ;
+    if(n == 0)
+      return;
+  }
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       printf(1, "cat: write error\n");
@@ -1,19 +1,32 @@
 struct buf;
 struct context;
 struct file;
+struct fsstat;
 struct inode;
+struct kmem_cache;
+struct iovec;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct share;
 struct spinlock;
 struct sleeplock;
+struct lockclass;
+struct lockstat;
+struct memstat;
 struct stat;
 struct superblock;
+struct sysstat;
+struct trapframe;
+struct wmap_region;
 struct wmapinfo;
 struct pgdirinfo;
 
 // bio.c
 void            binit(void);
+struct buf*     bgetanon(void);
+void            bholdanon(struct buf*);
+void            bputanon(struct buf*);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
@@ -32,16 +45,31 @@ struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
+int             filepread(struct file*, char*, int n, uint);
+int             filepwrite(struct file*, char*, int n, uint);
 int             fileread(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             filesplice(struct file*, struct file*, int);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int);
 
 // fs.c
+void            ballocinit(int);
 void            readsb(int dev, struct superblock *sb);
+void            dirinit(struct inode*);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, char*, uint);
+int             fsstat(int, struct fsstat*);
 struct inode*   ialloc(uint, short);
+struct buf*     ibread(struct inode*, uint);
+uint            iwritable(struct inode*, uint, uint, int*);
+int             delayreserve(int);
+void            delayrelease(int);
+void            delayflush(void);
 struct inode*   idup(struct inode*);
+void            iexec(struct inode*, int);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -67,6 +95,7 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+uint            kfreepages(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
@@ -79,6 +108,7 @@ void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(int, int);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
@@ -88,6 +118,10 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            logflush(void);
+void            logflusher(void);
+void            logstat(struct fsstat*);
+void            logstatreset(void);
 
 // mp.c
 extern int      ismp;
@@ -98,18 +132,28 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
+int             pipereadv(struct pipe*, struct iovec*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipewait(struct pipe*);
+int             pipeput(struct pipe*, char*, int);
 
 //PAGEBREAK: 16
 // proc.c
+int             clone(void(*)(void*, void*), void*, void*, void*);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             futex(uint, int, int);
 int             growproc(int);
+struct file*    ofileget(struct share*, int);
+int             ofilegrow(struct share*);
+int             join(void**);
 int             kill(int);
+int             kproc(char*, void(*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -117,8 +161,11 @@ void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
+int             shareown(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+int             vmrefs(pde_t*);
+int             wmaprelease(struct wmap_region*);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
@@ -126,11 +173,23 @@ void            yield(void);
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(void*);
+void            kmem_cache_stat(struct memstat*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+struct lockclass* lockclass(char*, int);
+int             lockstat(int, struct lockstat*);
+void            lockstatacquire(struct lockclass*, int, unsigned long long);
+void            lockstatrelease(struct lockclass*, uint);
+extern int      lockstaton;
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
@@ -157,12 +216,23 @@ int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
 void            syscall(void);
+int             sysstat(int, struct sysstat*);
 
 // timer.c
 void            timerinit(void);
 
+// text.c
+void            textinit(void);
+void            textdup(char*);
+char*           textget(struct inode*, uint);
+int             textadd(struct inode*, uint, char*);
+void            textinval(struct inode*);
+void            textput(char*);
+void            textstat(struct memstat*);
+
 // trap.c
 void            idtinit(void);
+void            sysenter(struct trapframe*);
 extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
@@ -177,11 +247,20 @@ void            seginit(void);
 void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
+char*           swapupage(pde_t*, char*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
+void            unmaprange(pde_t*, uint, uint, int);
+void            tlbinval(pde_t*, uint*, int);
+void            tlbpoll(void);
+void            tlbstat(struct memstat*);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
+int             pagein(struct proc*, uint);
+int             prefault(struct proc*, uint, uint);
+int             unsharetext(struct proc*, uint);
+void            heapstat(struct proc*, struct memstat*);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
@@ -194,6 +273,8 @@ int             getwmapinfo(struct wmapinfo *wmi);
 int             getpgdirinfo(struct pgdirinfo *pgdi);
 pte_t*          walkpgdir(pde_t *pgdir, const void *va, int alloc);
 int             mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm);
+int             region_overlaps(struct proc *curproc, uint addr, int length);
+struct wmap_region* wmapregionalloc(void);
 
 
 
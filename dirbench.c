@@ -0,0 +1,82 @@
+// Time creating, looking up and unlinking many files in
+// one directory.
+//
+//   dirbench [nfiles]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define N 100
+
+char path[16] = "dirbench.d/";
+
+// Point path at file number i.
+static void
+setname(int i)
+{
+  char *p;
+
+  p = path + strlen("dirbench.d/");
+  *p++ = 'f';
+  *p++ = '0' + i/1000 % 10;
+  *p++ = '0' + i/100 % 10;
+  *p++ = '0' + i/10 % 10;
+  *p++ = '0' + i % 10;
+  *p = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, fd, t0;
+
+  n = N;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0 || n > 10000){
+    printf(2, "usage: dirbench [nfiles]\n");
+    exit();
+  }
+  if(mkdir("dirbench.d") < 0){
+    printf(2, "dirbench: cannot create dirbench.d\n");
+    exit();
+  }
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    setname(i);
+    if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+      printf(2, "dirbench: create %s failed\n", path);
+      n = i;
+      break;
+    }
+    close(fd);
+  }
+  printf(1, "create %d files: %d ticks\n", n, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    setname(i);
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf(2, "dirbench: open %s failed\n", path);
+      exit();
+    }
+    close(fd);
+  }
+  printf(1, "look up %d files: %d ticks\n", n, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    setname(i);
+    if(unlink(path) < 0){
+      printf(2, "dirbench: unlink %s failed\n", path);
+      exit();
+    }
+  }
+  printf(1, "unlink %d files: %d ticks\n", n, uptime() - t0);
+
+  unlink("dirbench.d");
+  exit();
+}
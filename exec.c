@@ -6,15 +6,21 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "share.h"
+#include "file.h"
 
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe;
+  struct vmseg seg[NSEG];
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
@@ -28,6 +34,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  exe = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,8 +45,10 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Load program into memory.  The first NSEG segments are only
+  // recorded here; pagein() reads their pages as they are touched.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -49,15 +58,35 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
+      goto bad;
+    if(nseg < NSEG){
+      if(ph.vaddr + ph.memsz >= KERNBASE)
+        goto bad;
+      seg[nseg].start = PGROUNDUP(sz);
+      seg[nseg].end = ph.vaddr + ph.memsz;
+      seg[nseg].vaddr = ph.vaddr;
+      seg[nseg].off = ph.off;
+      seg[nseg].filesz = ph.filesz;
+      seg[nseg].writable = (ph.flags & ELF_PROG_FLAG_WRITE) != 0;
+      nseg++;
+      if(sz < ph.vaddr + ph.memsz)
+        sz = ph.vaddr + ph.memsz;
+      continue;
+    }
+    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+      goto bad;
     if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  // Keep the reference to ip for pagein(), and keep writers
+  // out of it meanwhile.
+  iexec(ip, 1);
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
   // Allocate two pages at the next page boundary.
@@ -87,6 +116,10 @@ exec(char *path, char **argv)
   if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
 
+  // Other threads keep running in the old image.
+  if(shareown(curproc) < 0)
+    goto bad;
+
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
@@ -96,11 +129,24 @@ exec(char *path, char **argv)
   // Commit to the user image.
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
-  curproc->sz = sz;
+  curproc->sh->sz = sz;
+  ip = curproc->exe;
+  curproc->exe = exe;
+  memmove(curproc->seg, seg, nseg * sizeof(seg[0]));
+  curproc->nseg = nseg;
+  curproc->heapbase = sz;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
-  freevm(oldpgdir);
+  // Other threads may still be running in the old image.
+  if(vmrefs(oldpgdir) == 0)
+    freevm(oldpgdir);
+  if(ip){
+    iexec(ip, -1);
+    begin_op();
+    iput(ip);
+    end_op();
+  }
   return 0;
 
  bad:
@@ -110,5 +156,11 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    iexec(exe, -1);
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
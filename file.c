@@ -5,21 +5,29 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "buf.h"
+#include "mmu.h"
+#include "uio.h"
 
 struct devsw devsw[NDEV];
+// File structures come from a slab cache, so there is no
+// fixed limit on how many can be open.  ftable.lock protects
+// their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -28,16 +36,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,6 +72,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -112,46 +116,245 @@ fileread(struct file *f, char *addr, int n)
   panic("fileread");
 }
 
+// Read from file f into cnt buffers, holding the inode lock
+// across all of them.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, n, r;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_PIPE)
+    return pipereadv(f->pipe, iov, cnt);
+  if(f->type == FD_INODE){
+    n = 0;
+    ilock(f->ip);
+    for(i = 0; i < cnt; i++){
+      if((r = readi(f->ip, iov[i].base, f->off, iov[i].len)) < 0){
+        if(n == 0)
+          n = -1;
+        break;
+      }
+      f->off += r;
+      n += r;
+      if(r < iov[i].len)
+        break;
+    }
+    iunlock(f->ip);
+    return n;
+  }
+  panic("filereadv");
+}
+
+// Read from file f at offset off, leaving f->off alone.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  r = readi(f->ip, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
 //PAGEBREAK!
+// Log space a file write may use in one transaction: all
+// but the i-node, an indirect block and 2 blocks of slop.
+#define WRITELOG (MAXOPBLOCKS-1-1-2)
+
+// Delayed buffers to reserve for writing n bytes at off.
+#define WRITEBLOCKS(off, n) (((off)%BSIZE + (uint)(n) + BSIZE-1) / BSIZE)
+
+// Write n bytes to f's inode at *off, advancing *off.
+static int
+writeat(struct file *f, char *addr, int n, uint *off)
+{
+  int r, k, nlog;
+
+  // write as much at a time as fits in a log transaction;
+  // blocks that go on the delayed list take no log space
+  // until delayflush() allocates them.
+  int i = 0;
+  while(i < n){
+    int n1;
+
+    k = delayreserve(WRITEBLOCKS(*off, n - i));
+    begin_op();
+    ilock(f->ip);
+    f->ip->dreserve = k;
+    nlog = WRITELOG;
+    n1 = iwritable(f->ip, *off, n - i, &nlog);
+    if ((r = writei(f->ip, addr + i, *off, n1)) > 0)
+      *off += r;
+    k = f->ip->dreserve;
+    f->ip->dreserve = 0;
+    iunlock(f->ip);
+    end_op();
+    delayrelease(k);
+
+    if(r < 0)
+      break;
+    if(r != n1)
+      panic("short filewrite");
+    i += r;
+  }
+  return i == n ? n : -1;
+}
+
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
-
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
-  if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
+  if(f->type == FD_INODE)
+    return writeat(f, addr, n, &f->off);
+  panic("filewrite");
+}
 
+// Write to file f at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return writeat(f, addr, n, &off);
+}
+
+// Write cnt buffers to file f.  For an inode, the buffers
+// share log transactions and inode locks, each transaction
+// carrying as much as filewrite would put in one.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, j, n, n1, r, k, nlog, off, tot;
+
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_PIPE){
+    for(tot = i = 0; i < cnt; i++){
+      if(pipewrite(f->pipe, iov[i].base, iov[i].len) < 0)
+        return -1;
+      tot += iov[i].len;
+    }
+    return tot;
+  }
+  if(f->type == FD_INODE){
+    tot = 0;
+    i = 0;
+    off = 0;  // progress within iov[i]
+    r = 0;
+    while(i < cnt && r >= 0){
+      for(n = 0, j = i; j < cnt; j++)
+        n += iov[j].len - (j == i ? off : 0);
+      k = delayreserve(WRITEBLOCKS(f->off, n));
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
+      f->ip->dreserve = k;
+      nlog = WRITELOG;
+      for(n = 0; i < cnt; n += r){
+        n1 = iwritable(f->ip, f->off, iov[i].len - off, &nlog);
+        if(n1 == 0 && iov[i].len > off)
+          break;  // transaction is full
+        if((r = writei(f->ip, (char*)iov[i].base + off, f->off, n1)) < 0)
+          break;
+        if(r != n1)
+          panic("short filewritev");
         f->off += r;
+        off += r;
+        if(off == iov[i].len){
+          i++;
+          off = 0;
+        }
+      }
+      k = f->ip->dreserve;
+      f->ip->dreserve = 0;
       iunlock(f->ip);
       end_op();
+      delayrelease(k);
+      tot += n;
+    }
+    return r < 0 ? -1 : tot;
+  }
+  panic("filewritev");
+}
+
+
+// Move up to n bytes from file in to file out without
+// copying through user space.  A pipe is fed straight from
+// the buffer cache; everything else goes through a kernel
+// page.  Returns the number of bytes moved, 0 at end of
+// file, or -1 on error.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  struct buf *bp;
+  char *page;
+  int tot, m, r;
 
-      if(r < 0)
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+
+  page = 0;
+  r = 0;
+  for(tot = 0; tot < n; tot += r){
+    m = n - tot;
+    if(in->type == FD_INODE && in->ip->type == T_FILE &&
+       out->type == FD_PIPE){
+      // Wait for room first: never sleep holding a buffer.
+      if(pipewait(out->pipe) < 0){
+        r = -1;
+        break;
+      }
+      ilock(in->ip);
+      if(in->off >= in->ip->size){
+        iunlock(in->ip);
         break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
+      }
+      if(m > in->ip->size - in->off)
+        m = in->ip->size - in->off;
+      if(m > BSIZE - in->off%BSIZE)
+        m = BSIZE - in->off%BSIZE;
+      if((bp = ibread(in->ip, in->off)) != 0){
+        r = pipeput(out->pipe, (char*)bp->data + in->off%BSIZE, m);
+        brelse(bp);
+        if(r > 0)
+          in->off += r;
+        iunlock(in->ip);
+        if(r < 0)
+          break;
+        continue;
+      }
+      // A hole: take the copying path below.
+      iunlock(in->ip);
+    }
+    if(page == 0 && (page = kalloc()) == 0){
+      r = -1;
+      break;
+    }
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if((r = fileread(in, page, m)) <= 0)
+      break;
+    if(filewrite(out, page, r) != r){
+      r = -1;
+      break;
+    }
+    // End of file, or a pipe with no more data for now.
+    if(r < m){
+      tot += r;
+      break;
     }
-    return i == n ? n : -1;
   }
-  panic("filewrite");
+  if(page)
+    kfree(page);
+  if(tot == 0 && r < 0)
+    return -1;
+  return tot;
 }
-
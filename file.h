@@ -14,15 +14,24 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int nexec;          // Processes running this program
+  struct inode *hnext; // hash chain
+  struct inode *lprev; // LRU list of unreferenced inodes
+  struct inode *lnext;
+  struct inode *dnext; // list of inodes with delayed blocks
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int text;           // may have pages in the text cache?
+  struct buf *delayed; // blocks not yet allocated, by lbn
+  int dreserve;       // delayed buffers writei() may add
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  struct extent extents[NEXTENT];
+  uint dindirect;
 };
 
 // table mapping major device number to
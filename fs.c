@@ -20,9 +20,11 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "fsstat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void dcacheinit(void);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -51,32 +53,111 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
-
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+//
+// The blocks are divided into groups of BGROUP, and
+// bgroupfree[] counts the free blocks in each group, so that
+// balloc() can pass over groups that are full (or too full to
+// hold the run it wants) without reading the bitmap.  The
+// counts are built from the bitmap by ballocinit() and are
+// changed only while holding the buffer lock of the bitmap
+// block that covers the group; a reader without that lock
+// must treat a count as a hint.
+
+#define BGROUP     1024  // blocks per group; must divide BPB
+#define NPREALLOC  16    // free run length sought for a new extent
+
+static ushort bgroupfree[FSSIZE/BGROUP + 1];  // iinit() checks sb.size
+static uint nbgroup;
+
+// Count free blocks.  Called once the log has been recovered.
+void
+ballocinit(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, bi;
 
-  bp = 0;
+  nbgroup = (sb.size + BGROUP - 1) / BGROUP;
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bgroupfree[(b + bi) / BGROUP]++;
+    brelse(bp);
+  }
+}
+
+// Allocate a zeroed disk block at or after goal, wrapping
+// around to the start of the disk if need be.  If run > 1,
+// prefer the first block of a free run at least run blocks
+// long, so that an extent starting there has room to grow.
+static uint
+balloc(uint dev, uint goal, uint run)
+{
+  uint i, g, b, start, end, n;
+  struct buf *bp;
+
+  if(goal < sb.size - sb.nblocks || goal >= sb.size)
+    goal = sb.size - sb.nblocks;
+  for(;;){
+    // Visit goal's group from goal, the other groups,
+    // then goal's group again from its start.
+    for(i = 0; i <= nbgroup; i++){
+      g = (goal/BGROUP + i) % nbgroup;
+      if(bgroupfree[g] < run)
+        continue;
+      start = i == 0 ? goal : g*BGROUP;
+      end = min((g + 1)*BGROUP, sb.size);
+      bp = bread(dev, BBLOCK(start, sb));
+      n = 0;
+      for(b = start; b < end; b++){
+        if(bp->data[(b % BPB)/8] & (1 << (b % 8))){
+          n = 0;
+          continue;
+        }
+        if(++n < run)
+          continue;
+        b -= run - 1;
+        bp->data[(b % BPB)/8] |= 1 << (b % 8);  // Mark block in use.
+        bgroupfree[g]--;
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        bzero(dev, b);
+        return b;
       }
+      brelse(bp);
     }
-    brelse(bp);
+    if(run == 1)
+      break;
+    run = 1;  // No long enough run; take any free block.
   }
   panic("balloc: out of blocks");
 }
 
+// Allocate disk block b, which must be a data block,
+// if it is free.  Returns b, or 0 if b is in use.
+static uint
+ballocat(uint dev, uint b)
+{
+  struct buf *bp;
+  int bi, m;
+
+  if(b >= sb.size)
+    return 0;
+  bp = bread(dev, BBLOCK(b, sb));
+  bi = b % BPB;
+  m = 1 << (bi % 8);
+  if(bp->data[bi/8] & m){
+    brelse(bp);
+    return 0;
+  }
+  bp->data[bi/8] |= m;
+  bgroupfree[b / BGROUP]--;
+  log_write(bp);
+  brelse(bp);
+  bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -90,6 +171,7 @@ bfree(int dev, uint b)
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  bgroupfree[b / BGROUP]++;
   log_write(bp);
   brelse(bp);
 }
@@ -119,18 +201,20 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref is zero stays cached, on an LRU
+//   list, until iget() needs its slot for another inode.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid if it frees the inode.  An unreferenced
+//   entry keeps ip->valid, so using the inode again does
+//   not re-read it.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -154,10 +238,16 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// Entries are found through a hash table keyed by (dev, inum).
+// They come from a slab cache as needed, up to icache.max, which
+// iinit() sets in proportion to free memory; after that iget()
+// recycles the least recently used unreferenced entry.
+//
 // The icache.lock spin-lock protects the allocation of icache
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// holds, one must hold icache.lock while using any of those fields,
+// or the hash and LRU links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -165,27 +255,52 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *hash[NIHASH];
+  struct inode lru;      // lru.lnext is least recently used
+  int n;                 // entries allocated
+  int max;               // most entries to allocate
+  uint hits;
+  uint misses;
 } icache;
 
+// Delayed allocation; see delayflush().
+struct {
+  struct spinlock lock;
+  struct sleeplock flushlock; // one delayflush() at a time
+  int n;                      // buffers delayed or reserved
+  struct inode *list;         // inodes with delayed blocks
+  uint allocs;                // blocks delayflush() allocated
+} delay;
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inodecache", sizeof(struct inode));
+  icache.lru.lprev = icache.lru.lnext = &icache.lru;
+  icache.max = kfreepages() / ICACHEPGS;
+  if(icache.max < NINODE)
+    icache.max = NINODE;
+  if(icache.max > MAXINODE)
+    icache.max = MAXINODE;
+  dcacheinit();
+  initlock(&delay.lock, "delay");
+  initsleeplock(&delay.flushlock, "delayflush");
 
   readsb(dev, &sb);
+  if(sb.bsize != BSIZE)
+    panic("iinit: file system block size is not BSIZE");
+  if(sb.size > FSSIZE)
+    panic("iinit: file system larger than FSSIZE");
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d bsize %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.bsize);
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void dcachepurge(uint dev, uint dir);
 
 //PAGEBREAK!
 // Allocate an inode on device dev.
@@ -216,6 +331,8 @@ ialloc(uint dev, short type)
 // Copy a modified in-memory inode to disk.
 // Must be called after every change to an ip->xxx field
 // that lives on disk, since i-node cache is write-through.
+// The size on disk stops short of the first delayed block,
+// so that it never covers data not yet on disk.
 // Caller must hold ip->lock.
 void
 iupdate(struct inode *ip)
@@ -230,47 +347,100 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  if(ip->delayed && dip->size > ip->delayed->lbn * BSIZE)
+    dip->size = ip->delayed->lbn * BSIZE;
+  memmove(dip->extents, ip->extents, sizeof(ip->extents));
+  dip->dindirect = ip->dindirect;
   log_write(bp);
   brelse(bp);
 }
 
+static struct inode**
+ichain(uint dev, uint inum)
+{
+  return &icache.hash[(dev*31 + inum) % NIHASH];
+}
+
+// Take ip off the LRU list.  Caller must hold icache.lock.
+static void
+lruremove(struct inode *ip)
+{
+  ip->lprev->lnext = ip->lnext;
+  ip->lnext->lprev = ip->lprev;
+}
+
+// Find an entry to hold a new inode: a fresh one while
+// there is room, else the least recently used one, which
+// leaves its hash chain.  Caller must hold icache.lock.
+static struct inode*
+inew(void)
+{
+  struct inode *ip, **pp;
+
+  if(icache.n < icache.max && (ip = kmem_cache_alloc(icache.cache)) != 0){
+    memset(ip, 0, sizeof(*ip));
+    initsleeplock(&ip->lock, "inode");
+    icache.n++;
+    return ip;
+  }
+  if((ip = icache.lru.lnext) == &icache.lru)
+    panic("iget: no inodes");
+  lruremove(ip);
+  for(pp = ichain(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+    ;
+  *pp = ip->hnext;
+  return ip;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **chain;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  chain = ichain(dev, inum);
+  for(ip = *chain; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
+      icache.hits++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
   // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  icache.misses++;
+  ip = inew();
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = *chain;
+  *chain = ip;
   release(&icache.lock);
 
   return ip;
 }
 
+// Count a process starting (n = 1) or ceasing (n = -1) to run
+// the program in ip, which it pages in on demand; writei()
+// refuses to change the file while any is.  A count can only
+// rise from zero in exec(), with ip locked, so a writer that
+// holds the lock and sees zero is not racing an exec.
+void
+iexec(struct inode *ip, int n)
+{
+  acquire(&icache.lock);
+  ip->nexec += n;
+  release(&icache.lock);
+}
+
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode*
@@ -303,7 +473,8 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->extents, dip->extents, sizeof(ip->extents));
+    ip->dindirect = dip->dindirect;
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -332,6 +503,13 @@ void
 iput(struct inode *ip)
 {
   acquiresleep(&ip->lock);
+  if(ip->text){
+    acquire(&icache.lock);
+    int r = ip->ref;
+    release(&icache.lock);
+    if(r == 1)
+      textinval(ip);  // no one left to share the pages with
+  }
   if(ip->valid && ip->nlink == 0){
     acquire(&icache.lock);
     int r = ip->ref;
@@ -339,6 +517,8 @@ iput(struct inode *ip)
     if(r == 1){
       // inode has no links and no other references: truncate and free.
       itrunc(ip);
+      if(ip->type == T_DIR)
+        dcachepurge(ip->dev, ip->inum);
       ip->type = 0;
       iupdate(ip);
       ip->valid = 0;
@@ -347,7 +527,13 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    // Most recently used goes at the tail.
+    ip->lnext = &icache.lru;
+    ip->lprev = icache.lru.lprev;
+    icache.lru.lprev->lnext = ip;
+    icache.lru.lprev = ip;
+  }
   release(&icache.lock);
 }
 
@@ -363,40 +549,90 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
-
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// in blocks on the disk.  Runs of contiguous blocks are
+// described by the extents in ip->extents[], so mapping a
+// block in a run costs no disk reads.  Blocks that no extent
+// covers are listed in a two-level tree of indirect blocks
+// rooted at ip->dindirect.
+
+// Return the disk block for entry bn of the double-indirect
+// tree of ip.  If there is none and goal is non-zero, allocate
+// it, and any missing tree blocks, near goal; otherwise
+// return 0.
 static uint
-bmap(struct inode *ip, uint bn)
+bmapdind(struct inode *ip, uint bn, uint goal)
 {
   uint addr, *a;
   struct buf *bp;
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
+  if((addr = ip->dindirect) == 0){
+    if(!goal)
+      return 0;
+    ip->dindirect = addr = balloc(ip->dev, goal, 1);
   }
-  bn -= NDIRECT;
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[bn / NINDIRECT]) == 0 && goal){
+    a[bn / NINDIRECT] = addr = balloc(ip->dev, goal, 1);
+    log_write(bp);
+  }
+  brelse(bp);
+  if(addr == 0)
+    return 0;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[bn % NINDIRECT]) == 0 && goal){
+    a[bn % NINDIRECT] = addr = balloc(ip->dev, goal, 1);
+    log_write(bp);
   }
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one if alloc is set
+// and otherwise returns 0.  A new block extends an extent if
+// the disk block following the extent is free, or else starts
+// a new extent; only once all extents are in use does it go in
+// the double-indirect tree.  New blocks are placed right after
+// block bn-1, if it exists, or else in the inode's group.
+static uint
+bmap(struct inode *ip, uint bn, int alloc)
+{
+  struct extent *e;
+  uint addr, goal;
+
+  if(bn >= MAXFILE)
+    panic("bmap: out of range");
 
-  panic("bmap: out of range");
+  for(e = ip->extents; e < &ip->extents[NEXTENT]; e++)
+    if(bn - e->lbn < e->len)
+      return e->start + (bn - e->lbn);
+  if((addr = bmapdind(ip, bn, 0)) != 0 || !alloc)
+    return addr;
+
+  if(bn > 0 && (goal = bmap(ip, bn - 1, 0)) != 0)
+    goal++;
+  else
+    goal = sb.size - sb.nblocks + (ip->inum % nbgroup) * BGROUP;
+
+  for(e = ip->extents; e < &ip->extents[NEXTENT]; e++){
+    if(e->len > 0 && e->lbn + e->len == bn &&
+       ballocat(ip->dev, e->start + e->len)){
+      e->len++;
+      return e->start + e->len - 1;
+    }
+  }
+  for(e = ip->extents; e < &ip->extents[NEXTENT]; e++){
+    if(e->len == 0){
+      e->start = balloc(ip->dev, goal, NPREALLOC);
+      e->lbn = bn;
+      e->len = 1;
+      return e->start;
+    }
+  }
+  return bmapdind(ip, bn, goal);
 }
 
 // Truncate inode (discard contents).
@@ -408,26 +644,34 @@ static void
 itrunc(struct inode *ip)
 {
   int i, j;
-  struct buf *bp;
-  uint *a;
-
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+  struct buf *bp, *bp2;
+  struct extent *e;
+  uint *a, *a2;
+
+  for(e = ip->extents; e < &ip->extents[NEXTENT]; e++){
+    for(i = 0; i < e->len; i++)
+      bfree(ip->dev, e->start + i);
+    memset(e, 0, sizeof(*e));
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  if(ip->dindirect){
+    bp = bread(ip->dev, ip->dindirect);
     a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+    for(i = 0; i < NINDIRECT; i++){
+      if(a[i] == 0)
+        continue;
+      bp2 = bread(ip->dev, a[i]);
+      a2 = (uint*)bp2->data;
+      for(j = 0; j < NINDIRECT; j++){
+        if(a2[j])
+          bfree(ip->dev, a2[j]);
+      }
+      brelse(bp2);
+      bfree(ip->dev, a[i]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->dindirect);
+    ip->dindirect = 0;
   }
 
   ip->size = 0;
@@ -446,13 +690,203 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+//PAGEBREAK!
+// Delayed allocation
+//
+// writei() puts data for a file block that has no disk block
+// yet in a buffer from bgetanon(), on the inode's delayed
+// list, and neither allocates nor logs anything.  Only
+// delayflush() gives those blocks disk addresses, all of a
+// file's at once and in file order, so a file written in
+// small pieces still gets long extents.  Until then the size
+// iupdate() writes stops at the first delayed block, and the
+// rest goes to disk in the transaction that logs the blocks:
+// after a crash a file may be shorter, but never holds zeroes
+// in place of data that was written.  It runs before
+// logflush() commits, and when writers run short of delayed
+// buffers: at most NDELAY can be out of the cache, and a
+// writer reserves them with delayreserve() before its
+// transaction, since it cannot flush inside one.
+
+// Most delayed blocks delayflush() allocates per transaction,
+// leaving room for the inode, two bitmap blocks and three
+// blocks of the double-indirect tree.
+#define DFLUSHBLOCKS (MAXOPBLOCKS-6)
+
+// Return ip's delayed buffer for block bn, or 0.
+// Caller must hold ip->lock.
+static struct buf*
+dbuf(struct inode *ip, uint bn)
+{
+  struct buf *b;
+
+  for(b = ip->delayed; b != 0 && b->lbn <= bn; b = b->dnext)
+    if(b->lbn == bn)
+      return b;
+  return 0;
+}
+
+// Add a zeroed delayed buffer for block bn of ip, using
+// one of ip->dreserve.  Caller must hold ip->lock.
+static struct buf*
+dnew(struct inode *ip, uint bn)
+{
+  struct buf *b, **pp;
+
+  if(ip->delayed == 0){
+    idup(ip);  // for delayflush()
+    acquire(&delay.lock);
+    ip->dnext = delay.list;
+    delay.list = ip;
+    release(&delay.lock);
+  }
+  ip->dreserve--;
+  b = bgetanon();
+  b->lbn = bn;
+  memset(b->data, 0, BSIZE);
+  for(pp = &ip->delayed; *pp != 0 && (*pp)->lbn < bn; pp = &(*pp)->dnext)
+    ;
+  b->dnext = *pp;
+  *pp = b;
+  return b;
+}
+
+// Reserve up to n delayed buffers for a write, flushing if
+// too few are free.  Returns how many it got, perhaps 0.
+// Called outside any transaction.
+int
+delayreserve(int n)
+{
+  if(n > NDELAY/2)
+    n = NDELAY/2;
+  acquire(&delay.lock);
+  if(delay.n + n > NDELAY){
+    release(&delay.lock);
+    delayflush();
+    acquire(&delay.lock);
+  }
+  if(n > NDELAY - delay.n)
+    n = NDELAY - delay.n;
+  delay.n += n;
+  release(&delay.lock);
+  return n;
+}
+
+// Give back n delayed buffers, reserved or flushed.
+void
+delayrelease(int n)
+{
+  acquire(&delay.lock);
+  delay.n -= n;
+  release(&delay.lock);
+}
+
+// Allocate and log ip's delayed blocks, a few per transaction,
+// then drop the reference dnew() took.  The blocks of a file
+// that is unlinked and closed are dropped instead.
+static void
+delayflushi(struct inode *ip)
+{
+  struct inode **pp;
+  struct buf *b, *bp;
+  int i, r, done;
+
+  do {
+    begin_op();
+    ilock(ip);
+    acquire(&icache.lock);
+    r = ip->ref;
+    release(&icache.lock);
+    for(i = 0; i < DFLUSHBLOCKS && (b = ip->delayed) != 0; i++){
+      if(ip->nlink > 0 || r > 1){
+        bp = bread(ip->dev, bmap(ip, b->lbn, 1));
+        memmove(bp->data, b->data, BSIZE);
+        log_write(bp);
+        brelse(bp);
+        acquire(&delay.lock);
+        delay.allocs++;
+        release(&delay.lock);
+      }
+      ip->delayed = b->dnext;
+      bputanon(b);
+      delayrelease(1);
+    }
+    iupdate(ip);  // bmap() changed the extents
+    if((done = ip->delayed == 0)){
+      acquire(&delay.lock);
+      for(pp = &delay.list; *pp != ip; pp = &(*pp)->dnext)
+        ;
+      *pp = ip->dnext;
+      release(&delay.lock);
+    }
+    iunlock(ip);
+    if(done)
+      iput(ip);
+    end_op();
+  } while(!done);
+}
+
+// Give every delayed block a disk block and log its data.
+// Called outside any transaction.
+void
+delayflush(void)
+{
+  struct inode *ip;
+
+  acquiresleep(&delay.flushlock);
+  for(;;){
+    acquire(&delay.lock);
+    ip = delay.list;
+    release(&delay.lock);
+    if(ip == 0)
+      break;
+    delayflushi(ip);
+  }
+  releasesleep(&delay.flushlock);
+}
+
+// Return how many of the n bytes at off writei() can write
+// to ip in a transaction with *nlog blocks of log space left,
+// and deduct their share.  A block already on disk costs one
+// log block, and one allocated now costs two, but one that
+// goes on the delayed list costs nothing until delayflush().
+// Caller must hold ip->lock.
+uint
+iwritable(struct inode *ip, uint off, uint n, int *nlog)
+{
+  uint tot, m, bn;
+  int cost, nd;
+
+  if(ip->type == T_DEV)
+    return n;
+  nd = ip->dreserve;
+  for(tot=0; tot<n; tot+=m, off+=m){
+    m = min(n - tot, BSIZE - off%BSIZE);
+    if((bn = off/BSIZE) >= MAXFILE)
+      return n;  // writei() refuses it all
+    if(bmap(ip, bn, 0) != 0)
+      cost = 1;
+    else if(dbuf(ip, bn) != 0)
+      cost = 0;
+    else if(ip->type == T_FILE && nd > 0){
+      nd--;
+      cost = 0;
+    } else
+      cost = 2;
+    if(cost > *nlog)
+      break;
+    *nlog -= cost;
+  }
+  return tot;
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -467,8 +901,15 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if((addr = bmap(ip, off/BSIZE, 0)) == 0){
+      if((bp = dbuf(ip, off/BSIZE)) != 0)
+        memmove(dst, bp->data + off%BSIZE, m);
+      else
+        memset(dst, 0, m);  // unallocated blocks read as zeroes
+      continue;
+    }
+    bp = bread(ip->dev, addr);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
   }
@@ -476,12 +917,32 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 }
 
 // PAGEBREAK!
-// Write data to inode.
+// Return the locked buffer holding the block of ip that
+// contains byte off, which may be a delayed buffer, or 0 if
+// that block is unallocated.
+// Caller must hold ip->lock and brelse() the buffer.
+struct buf*
+ibread(struct inode *ip, uint off)
+{
+  struct buf *b;
+  uint addr;
+
+  if((addr = bmap(ip, off/BSIZE, 0)) == 0){
+    if((b = dbuf(ip, off/BSIZE)) != 0)
+      bholdanon(b);
+    return b;
+  }
+  return bread(ip->dev, addr);
+}
+
+// Write data to inode.  A new block of a regular file goes
+// on the delayed list if ip->dreserve allows, and is
+// allocated now otherwise.
 // Caller must hold ip->lock.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, bn, addr;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -494,10 +955,28 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  acquire(&icache.lock);
+  m = ip->nexec;
+  release(&icache.lock);
+  if(m > 0)
+    return -1;  // a running process still reads pages from it
+  if(ip->text)
+    textinval(ip);  // programs exec'd from now on see the new contents
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    bn = off/BSIZE;
+    if((addr = bmap(ip, bn, 0)) == 0){
+      bp = dbuf(ip, bn);
+      if(bp == 0 && ip->type == T_FILE && ip->dreserve > 0)
+        bp = dnew(ip, bn);
+      if(bp != 0){
+        memmove(bp->data + off%BSIZE, src, m);
+        continue;
+      }
+      addr = bmap(ip, bn, 1);
+    }
+    bp = bread(ip->dev, addr);
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
     brelse(bp);
@@ -513,38 +992,318 @@ writei(struct inode *ip, char *src, uint off, uint n)
 //PAGEBREAK!
 // Directories
 
+// Directory name lookup cache.
+//
+// The dcache remembers the outcome of recent dirlookup()s as
+// (dev, directory inum, name) -> (inum, offset), so that namex()
+// does not re-read every directory on the path each time.
+// An entry whose inum is 0 is negative: the name is known to
+// be absent.  All changes to a directory's entries go through
+// dirlink() or dirunlink(), which keep the cache current, and
+// callers hold the directory's ip->lock throughout.  When a
+// directory inode is freed its entries are purged, so a later
+// directory that reuses the inum starts out with none.
+//
+// dcache.lock protects all fields.
+
+struct dentry {
+  uint dev;
+  uint dir;              // inum of directory; 0 if entry unused
+  char name[DIRSIZ];
+  uint inum;             // 0 for a negative entry
+  uint off;              // byte offset of dirent in dir
+  struct dentry *next;   // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry entry[NDCACHE];
+  struct dentry *hash[NDCACHE];
+  int hand;              // next entry to recycle
+  uint hits;
+  uint misses;
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry**
+dcachechain(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev*31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return &dcache.hash[h % NDCACHE];
+}
+
+// Caller must hold dcache.lock.
+static struct dentry*
+dcachefind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dcachechain(dev, dir, name); d; d = d->next)
+    if(d->dir == dir && d->dev == dev && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Remove d from its hash chain and mark it unused.
+// Caller must hold dcache.lock.
+static void
+dcacheunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dcachechain(d->dev, d->dir, d->name); *pp; pp = &(*pp)->next){
+    if(*pp == d){
+      *pp = d->next;
+      break;
+    }
+  }
+  d->dir = 0;
+}
+
+// Look name up in the cache for directory dp.
+// On a hit, set *pinum and *poff and return 1.
+static int
+dcacheget(struct inode *dp, char *name, uint *pinum, uint *poff)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcachefind(dp->dev, dp->inum, name)) == 0){
+    dcache.misses++;
+    release(&dcache.lock);
+    return 0;
+  }
+  dcache.hits++;
+  *pinum = d->inum;
+  *poff = d->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp refers to inum
+// (0 if absent) at offset off.
+static void
+dcacheput(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d, **chain;
+
+  acquire(&dcache.lock);
+  if((d = dcachefind(dp->dev, dp->inum, name)) == 0){
+    // Recycle entries round-robin.
+    d = &dcache.entry[dcache.hand];
+    dcache.hand = (dcache.hand + 1) % NDCACHE;
+    if(d->dir != 0)
+      dcacheunhash(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    chain = dcachechain(d->dev, d->dir, d->name);
+    d->next = *chain;
+    *chain = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  release(&dcache.lock);
+}
+
+// Forget all entries for directory dir, which is being freed.
+static void
+dcachepurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.entry; d < &dcache.entry[NDCACHE]; d++)
+    if(d->dir == dir && d->dev == dev)
+      dcacheunhash(d);
+  release(&dcache.lock);
+}
+
+// Report or reset file system cache statistics.
+int
+fsstat(int cmd, struct fsstat *st)
+{
+  switch(cmd){
+  case FSSTAT_RESET:
+    acquire(&dcache.lock);
+    dcache.hits = 0;
+    dcache.misses = 0;
+    release(&dcache.lock);
+    acquire(&icache.lock);
+    icache.hits = 0;
+    icache.misses = 0;
+    release(&icache.lock);
+    acquire(&delay.lock);
+    delay.allocs = 0;
+    release(&delay.lock);
+    logstatreset();
+    return 0;
+  case FSSTAT_GET:
+    memset(st, 0, sizeof(*st));
+    acquire(&dcache.lock);
+    st->dcache_hits = dcache.hits;
+    st->dcache_misses = dcache.misses;
+    release(&dcache.lock);
+    acquire(&icache.lock);
+    st->icache_hits = icache.hits;
+    st->icache_misses = icache.misses;
+    st->icache_size = icache.n;
+    release(&icache.lock);
+    acquire(&delay.lock);
+    st->delay_allocs = delay.allocs;
+    release(&delay.lock);
+    logstat(st);
+    return 0;
+  }
+  return -1;
+}
+
 int
 namecmp(const char *s, const char *t)
 {
   return strncmp(s, t, DIRSIZ);
 }
 
+// Look for name among the first n dirents of the directory
+// block in bp.  Return its slot, or -1.
+static int
+dirfind(struct buf *bp, int n, char *name)
+{
+  struct dirent *de;
+  int i;
+
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < n; i++)
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0)
+      return i;
+  return -1;
+}
+
+// Number of the block after bp in a hashed directory's
+// bucket chain, or 0 at the end of the chain.
+static uint
+dirnext(struct buf *bp)
+{
+  uint next;
+
+  memmove(&next, ((struct dirent*)bp->data)[DPB-1].name, sizeof(next));
+  return next;
+}
+
+// Search directory dp for name, a block at a time.
+// Return its inum and set *poff, or return 0 if it is absent.
+static uint
+dirscan(struct inode *dp, char *name, uint *poff)
+{
+  struct buf *bp;
+  uint fbn, off, addr, inum;
+  int i;
+
+  if(dp->major == DIRHASH){
+    // Only name's bucket chain can hold it.
+    fbn = dirhash(name) % NDIRBUCKET;
+    while((addr = bmap(dp, fbn, 0)) != 0){
+      bp = bread(dp->dev, addr);
+      if((i = dirfind(bp, DPB-1, name)) >= 0)
+        goto found;
+      fbn = dirnext(bp);
+      brelse(bp);
+      if(fbn == 0)
+        break;
+    }
+    return 0;
+  }
+
+  for(off = 0; off < dp->size; off += BSIZE){
+    fbn = off / BSIZE;
+    if((addr = bmap(dp, fbn, 0)) == 0)
+      continue;
+    bp = bread(dp->dev, addr);
+    if((i = dirfind(bp, min(DPB, (dp->size - off) / sizeof(struct dirent)), name)) >= 0)
+      goto found;
+    brelse(bp);
+  }
+  return 0;
+
+found:
+  *poff = fbn*BSIZE + i*sizeof(struct dirent);
+  inum = ((struct dirent*)bp->data)[i].inum;
+  brelse(bp);
+  return inum;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
-  struct dirent de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+  if(!dcacheget(dp, name, &inum, &off)){
+    off = 0;
+    inum = dirscan(dp, name, &off);
+    dcacheput(dp, name, inum, off);
   }
+  if(inum == 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
+}
 
-  return 0;
+// Find a free slot for name in the hashed directory dp,
+// lengthening name's bucket chain by a block if it is full.
+// Return the slot's byte offset, or -1 if dp is too large.
+static int
+dirslot(struct inode *dp, char *name)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint fbn, next, addr;
+  int i;
+
+  fbn = dirhash(name) % NDIRBUCKET;
+  for(;;){
+    if((addr = bmap(dp, fbn, 0)) == 0)
+      return fbn*BSIZE;  // unused bucket; writei() allocates it
+    bp = bread(dp->dev, addr);
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < DPB-1; i++){
+      if(de[i].inum == 0){
+        brelse(bp);
+        return fbn*BSIZE + i*sizeof(*de);
+      }
+    }
+    if((next = dirnext(bp)) == 0){
+      // Chain a new block, at the end of the directory, after fbn.
+      next = dp->size / BSIZE;
+      if(next >= MAXFILE){
+        brelse(bp);
+        return -1;
+      }
+      memmove(de[DPB-1].name, &next, sizeof(next));
+      log_write(bp);
+      brelse(bp);
+      dp->size += BSIZE;
+      iupdate(dp);
+      return next*BSIZE;
+    }
+    brelse(bp);
+    fbn = next;
+  }
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -561,22 +1320,52 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(dp->major == DIRHASH){
+    if((off = dirslot(dp, name)) < 0)
+      return -1;
+  } else {
+    // Look for an empty dirent.
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        break;
+    }
   }
 
+  memset(&de, 0, sizeof(de));
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcacheput(dp, name, inum, off);
 
   return 0;
 }
 
+// Make dp, a new and empty directory, a hashed one.
+// Caller must hold dp->lock.
+void
+dirinit(struct inode *dp)
+{
+  dp->major = DIRHASH;
+  dp->size = NDIRBUCKET*BSIZE;
+  iupdate(dp);
+}
+
+// Remove the entry for name, which dirlookup() found at
+// byte offset off, from the directory dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink");
+  dcacheput(dp, name, 0, 0);
+}
+
 //PAGEBREAK!
 // Paths
 
@@ -3,7 +3,7 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define BSIZE 4096  // block size; recorded in the super block
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -19,11 +19,21 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes); must be BSIZE
 };
 
-#define NDIRECT 12
+// A file's blocks are mapped first by up to NEXTENT extents,
+// each a run of contiguous disk blocks, and then by a
+// double-indirect block for anything the extents do not cover.
+#define NEXTENT 4
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define MAXFILE (NINDIRECT * NINDIRECT - 1)  // MAXFILE*BSIZE fits in a uint
+
+struct extent {
+  uint lbn;             // First file block in the run
+  uint start;           // Disk block holding file block lbn
+  uint len;             // Number of blocks; 0 if extent unused
+};
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +42,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  struct extent extents[NEXTENT];  // Runs of data blocks
+  uint dindirect;       // Double-indirect block
 };
 
 // Inodes per block.
@@ -55,3 +66,28 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Dirents per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory whose major number is DIRHASH is hashed.  It is
+// created NDIRBUCKET blocks long, with blocks allocated only as
+// they are used, and the entry for a name lives in the chain of
+// blocks that starts at block dirhash(name) % NDIRBUCKET.  The
+// last dirent of each block is not an entry (its inum is 0): its
+// name field holds the number of the next block in the chain, or
+// 0 at the end.  Any other directory is a flat array of dirents.
+#define DIRHASH       1
+#define NDIRBUCKET    8
+
+static inline uint
+dirhash(const char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;  // FNV-1a
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
@@ -0,0 +1,29 @@
+// Report file system cache statistics.
+//
+//   fsstat [reset]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fsstat.h"
+
+struct fsstat st;
+
+int
+main(int argc, char *argv[])
+{
+  if(argc > 1 && strcmp(argv[1], "reset") == 0){
+    fsstat(FSSTAT_RESET, 0);
+    exit();
+  }
+  if(fsstat(FSSTAT_GET, &st) < 0){
+    printf(2, "fsstat: failed\n");
+    exit();
+  }
+  printf(1, "dcache: %d hits %d misses\n", st.dcache_hits, st.dcache_misses);
+  printf(1, "icache: %d hits %d misses %d inodes\n",
+         st.icache_hits, st.icache_misses, st.icache_size);
+  printf(1, "log: %d commits %d blocks\n", st.log_commits, st.log_blocks);
+  printf(1, "delay: %d blocks allocated\n", st.delay_allocs);
+  exit();
+}
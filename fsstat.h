@@ -0,0 +1,14 @@
+// for `fsstat`
+#define FSSTAT_GET   0  // fill in struct fsstat
+#define FSSTAT_RESET 1  // zero all counters
+
+struct fsstat {
+  uint dcache_hits;     // directory lookups answered by the name cache
+  uint dcache_misses;   // directory lookups that scanned the directory
+  uint icache_hits;     // inode lookups that found the inode cached
+  uint icache_misses;   // inode lookups that filled a new cache entry
+  uint icache_size;     // in-memory inodes allocated
+  uint log_commits;     // log transactions committed
+  uint log_blocks;      // blocks written through the log
+  uint delay_allocs;    // delayed blocks given disk blocks
+};
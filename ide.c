@@ -23,6 +23,7 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
@@ -33,6 +34,7 @@ static struct buf *idequeue;
 
 static int havedisk1;
 static void idestart(struct buf*);
+static void idesetmult(int);
 
 // Wait for IDE disk to become ready.
 static int
@@ -65,10 +67,30 @@ ideinit(void)
     }
   }
 
+  // Transfer a whole block per interrupt with
+  // READ/WRITE MULTIPLE.
+  if(BSIZE > SECTOR_SIZE){
+    idesetmult(0);
+    if(havedisk1)
+      idesetmult(1);
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
+// Set the number of sectors disk moves per interrupt
+// in READ/WRITE MULTIPLE to the sectors in a block.
+static void
+idesetmult(int disk)
+{
+  idewait(0);
+  outb(0x1f6, 0xe0 | (disk<<4));
+  outb(0x1f2, BSIZE/SECTOR_SIZE);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  idewait(0);
+}
+
 // Start the request for b.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
@@ -82,7 +104,7 @@ idestart(struct buf *b)
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
+  if (sector_per_block > 16) panic("idestart");  // most drives' multiple limit
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
@@ -0,0 +1,67 @@
+// Report lock contention statistics.
+//
+//   lockstat on|off|reset
+//   lockstat [n]           print the n most contended locks (default 10)
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "lockstat.h"
+
+struct lockstat st;
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, n, t, order[MAX_LOCKSTAT];
+
+  if(argc > 1 && strcmp(argv[1], "on") == 0){
+    lockstat(LOCKSTAT_ENABLE, 0);
+    exit();
+  }
+  if(argc > 1 && strcmp(argv[1], "off") == 0){
+    lockstat(LOCKSTAT_DISABLE, 0);
+    exit();
+  }
+  if(argc > 1 && strcmp(argv[1], "reset") == 0){
+    lockstat(LOCKSTAT_RESET, 0);
+    exit();
+  }
+
+  n = 10;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(lockstat(LOCKSTAT_GET, &st) < 0){
+    printf(2, "lockstat: failed\n");
+    exit();
+  }
+  if(!st.enabled)
+    printf(1, "(accounting is off; run \"lockstat on\")\n");
+
+  // Sort by contended acquisitions, then by time spent waiting.
+  for(i = 0; i < st.nlocks; i++)
+    order[i] = i;
+  for(i = 1; i < st.nlocks; i++){
+    for(j = i; j > 0; j--){
+      t = order[j];
+      if(st.contended[t] < st.contended[order[j-1]])
+        break;
+      if(st.contended[t] == st.contended[order[j-1]] &&
+         st.kcycles[t] <= st.kcycles[order[j-1]])
+        break;
+      order[j] = order[j-1];
+      order[j-1] = t;
+    }
+  }
+
+  printf(1, "lock            type    acquires    contended    wait kcycles    max hold\n");
+  for(i = 0; i < st.nlocks && i < n; i++){
+    t = order[i];
+    printf(1, "%s", st.name[t]);
+    for(j = strlen(st.name[t]); j < 16; j++)
+      printf(1, " ");
+    printf(1, "%s    %d    %d    %d    %d\n", st.sleeplock[t] ? "sleep" : "spin ",
+           st.acquires[t], st.contended[t], st.kcycles[t], st.maxhold[t]);
+  }
+  exit();
+}
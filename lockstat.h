@@ -0,0 +1,20 @@
+// for `lockstat`
+#define LOCKSTAT_GET     0  // fill in struct lockstat
+#define LOCKSTAT_ENABLE  1  // start counting
+#define LOCKSTAT_DISABLE 2  // stop counting
+#define LOCKSTAT_RESET   3  // zero all counters
+
+// Locks are grouped into classes by the name given to
+// initlock()/initsleeplock(), so e.g. all "buffer" locks
+// are reported together.
+#define MAX_LOCKSTAT 32
+struct lockstat {
+  int enabled;                      // is accounting on?
+  int nlocks;                       // number of classes filled in
+  char name[MAX_LOCKSTAT][16];      // lock name
+  int sleeplock[MAX_LOCKSTAT];      // 1 for sleep locks, 0 for spinlocks
+  uint acquires[MAX_LOCKSTAT];      // total acquisitions
+  uint contended[MAX_LOCKSTAT];     // acquisitions that had to spin or sleep
+  uint kcycles[MAX_LOCKSTAT];       // cycles spent waiting / 1024
+  uint maxhold[MAX_LOCKSTAT];       // longest hold time, in cycles
+};
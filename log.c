@@ -5,6 +5,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "fsstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -18,7 +19,18 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// asks for a commit and sleeps until the last outstanding
+// end_op() performs it.
+//
+// The log is write-back: end_op() does not commit by itself,
+// so the blocks of many system calls collect in one
+// transaction, and a block written again and again (say by
+// a stream of small appends) is logged once.  A commit
+// happens only when the log is nearly full, or when
+// logflush() is called by sync() or by the logflusher kernel
+// process every FLUSHTICKS, and waits for the outstanding
+// system calls to end.  logflush() first has delayflush()
+// allocate the blocks that writes left waiting in the cache.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -42,6 +54,10 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int wantcommit;  // commit once outstanding drops to 0.
+  uint ncommit;    // commits so far; logflush() waits on it
+  uint commits;    // commits since statistics were reset
+  uint logged;     // blocks logged since statistics were reset
   int dev;
   struct logheader lh;
 };
@@ -121,17 +137,47 @@ recover_from_log(void)
   write_head(); // clear the log
 }
 
+// Commit the current transaction.  Caller holds log.lock,
+// which is released while writing, and has made sure no FS
+// system calls are outstanding.
+static void
+docommit(void)
+{
+  int n;
+
+  n = log.lh.n;
+  log.committing = 1;
+  log.wantcommit = 0;
+  release(&log.lock);
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  log.ncommit++;
+  if(n > 0){
+    log.commits++;
+    log.logged += n;
+  }
+  wakeup(&log);
+}
+
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.committing || log.wantcommit){
       sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+      // this op might exhaust log space; commit first.
+      if(log.outstanding == 0)
+        docommit();
+      else {
+        log.wantcommit = 1;
+        sleep(&log, &log.lock);
+      }
     } else {
       log.outstanding += 1;
       release(&log.lock);
@@ -141,19 +187,17 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and a commit has been asked for.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 && log.wantcommit){
+    docommit();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -161,16 +205,69 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Commit every FS system call that has finished, and
+// wait until the commit is on disk.
+void
+logflush(void)
+{
+  uint target;
+
+  delayflush();
+  acquire(&log.lock);
+  // A commit in progress includes every finished call,
+  // since none can start while it runs.
+  target = log.ncommit;
+  if(log.committing || log.lh.n > 0)
+    target++;
+  while(log.ncommit < target){
+    if(!log.committing){
+      if(log.outstanding == 0){
+        docommit();
+        continue;
+      }
+      log.wantcommit = 1;
+    }
+    sleep(&log, &log.lock);
   }
+  release(&log.lock);
+}
+
+// Body of the logflusher kernel process, which bounds
+// how long written data can sit uncommitted in the cache.
+void
+logflusher(void)
+{
+  uint t0;
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < FLUSHTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+    logflush();
+  }
+}
+
+// Report log statistics.
+void
+logstat(struct fsstat *st)
+{
+  acquire(&log.lock);
+  st->log_commits = log.commits;
+  st->log_blocks = log.logged;
+  release(&log.lock);
+}
+
+void
+logstatreset(void)
+{
+  acquire(&log.lock);
+  log.commits = 0;
+  log.logged = 0;
+  release(&log.lock);
 }
 
 // Copy modified blocks from cache to log.
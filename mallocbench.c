@@ -0,0 +1,93 @@
+// Time malloc and free on a mix of block sizes, and report
+// the most memory the heap and wmap regions held at once.
+//
+//   mallocbench [nops]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "wmap.h"
+#include "memstat.h"
+
+#define N     20000  // default number of operations
+#define NLIVE 512    // blocks that may be live at once
+
+char *live[NLIVE];
+uint seed = 1;
+uint peak;
+
+static uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+// Note the pages currently resident in the heap and in wmap
+// regions, keeping the largest total seen.
+static void
+sample(void)
+{
+  struct memstat ms;
+  struct wmapinfo wi;
+  uint n;
+  int i;
+
+  n = 0;
+  if(memstat(&ms) == 0)
+    n += ms.heap_resident;
+  if(getwmapinfo(&wi) == 0)
+    for(i = 0; i < wi.total_mmaps; i++)
+      n += wi.n_loaded_pages[i];
+  if(n > peak)
+    peak = n;
+}
+
+// Run n random malloc/free operations on blocks of up to
+// maxsize bytes, touching the first byte of each.
+static void
+run(char *name, int n, uint maxsize)
+{
+  int i, j, t0, t;
+
+  peak = 0;
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    j = rand() % NLIVE;
+    if(live[j]){
+      free(live[j]);
+      live[j] = 0;
+    } else if((live[j] = malloc(1 + rand() % maxsize)) != 0)
+      live[j][0] = 1;
+    if(i % 256 == 0)
+      sample();
+  }
+  sample();
+  for(j = 0; j < NLIVE; j++){
+    free(live[j]);
+    live[j] = 0;
+  }
+  t = uptime() - t0;
+  printf(1, "%s: %d ops in %d ticks", name, n, t);
+  if(t > 0)
+    printf(1, ", %d ops/sec", n * 100 / t);
+  printf(1, ", peak %d KB\n", peak * 4);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n;
+
+  n = N;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0 || n > 1000000){
+    printf(2, "usage: mallocbench [nops]\n");
+    exit();
+  }
+  run("small (<= 128 bytes)", n, 128);
+  run("medium (<= 8 KB)", n, 8192);
+  run("large (<= 256 KB)", n / 10, 256*1024);
+  exit();
+}
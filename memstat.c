@@ -0,0 +1,33 @@
+// Report kernel memory statistics.
+//
+//   memstat
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+struct memstat st;
+
+int
+main(void)
+{
+  int i;
+
+  if(memstat(&st) < 0){
+    printf(2, "memstat: failed\n");
+    exit();
+  }
+  printf(1, "free: %d pages\n", st.free_pages);
+  printf(1, "text: %d cached %d in use %d maps\n",
+         st.text_cached, st.text_inuse, st.text_maps);
+  printf(1, "heap: %d reserved %d resident\n",
+         st.heap_reserved, st.heap_resident);
+  printf(1, "tlb: %d shootdowns sent %d answered\n",
+         st.tlb_sent, st.tlb_received);
+  for(i = 0; i < st.ncache; i++)
+    printf(1, "%s: size %d inuse %d slabs %d allocs %d\n",
+           st.cache[i].name, st.cache[i].size, st.cache[i].inuse,
+           st.cache[i].slabs, st.cache[i].allocs);
+  exit();
+}
@@ -0,0 +1,21 @@
+// for `memstat`
+#define MEMSTAT_NCACHE 8  // most kernel object caches reported
+
+struct memstat {
+  uint free_pages;   // physical pages kalloc() has free
+  uint text_cached;  // program text pages in the text cache
+  uint text_inuse;   // text pages mapped by at least one process
+  uint text_maps;    // mappings of text pages, over all processes
+  uint heap_reserved; // pages of the caller's heap sbrk() has handed out
+  uint heap_resident; // how many of those have been touched
+  uint tlb_sent;      // TLB shootdown IPIs sent, over all CPUs
+  uint tlb_received;  // TLB shootdowns answered, over all CPUs
+  int ncache;         // entries used in cache[]
+  struct {
+    char name[16];
+    uint size;        // bytes per object
+    uint inuse;       // objects allocated
+    uint slabs;       // pages held
+    uint allocs;      // allocations since boot
+  } cache[MEMSTAT_NCACHE];  // kernel slab caches
+};
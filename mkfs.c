@@ -15,7 +15,7 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 4096
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
@@ -40,6 +40,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirappend(uint dir, char *name, uint inum);
 
 // convert to intel byte order
 ushort
@@ -68,8 +69,7 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
   char buf[BSIZE];
   struct dinode din;
 
@@ -90,7 +90,7 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  // 1 fs block = 1 disk sector
+  // 1 fs block = BSIZE bytes of the image
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
 
@@ -101,6 +101,7 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.bsize = xint(BSIZE);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
@@ -117,15 +118,14 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  // The root is a hashed directory; see fs.h.
+  rinode(rootino, &din);
+  din.major = xshort(DIRHASH);
+  din.size = xint(NDIRBUCKET*BSIZE);
+  winode(rootino, &din);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  dirappend(rootino, ".", rootino);
+  dirappend(rootino, "..", rootino);
 
   for(i = 2; i < argc; i++){
     assert(index(argv[i], '/') == 0);
@@ -143,11 +143,7 @@ main(int argc, char *argv[])
       ++argv[i];
 
     inum = ialloc(T_FILE);
-
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    dirappend(rootino, argv[i], inum);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -155,13 +151,6 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
-
   balloc(freeblock);
 
   exit(0);
@@ -252,6 +241,64 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry i of the indirect block *bp, allocating the
+// indirect block and the entry if alloc is set.
+uint
+indirect(uint *bp, uint i, int alloc)
+{
+  uint a[NINDIRECT];
+
+  if(xint(*bp) == 0){
+    if(!alloc)
+      return 0;
+    *bp = xint(freeblock++);
+  }
+  rsect(xint(*bp), (char*)a);
+  if(a[i] == 0 && alloc){
+    a[i] = xint(freeblock++);
+    wsect(xint(*bp), (char*)a);
+  }
+  return xint(a[i]);
+}
+
+// Return the block holding block fbn of the file
+// described by din, allocating it as the kernel's
+// bmap() would if necessary.
+uint
+ibmap(struct dinode *din, uint fbn)
+{
+  struct extent *e;
+  uint x, mid;
+
+  assert(fbn < MAXFILE);
+  for(e = din->extents; e < &din->extents[NEXTENT]; e++)
+    if(fbn - xint(e->lbn) < xint(e->len))
+      return xint(e->start) + fbn - xint(e->lbn);
+  if((mid = indirect(&din->dindirect, fbn / NINDIRECT, 0)) != 0){
+    mid = xint(mid);
+    if((x = indirect(&mid, fbn % NINDIRECT, 0)) != 0)
+      return x;
+  }
+
+  for(e = din->extents; e < &din->extents[NEXTENT]; e++){
+    if(xint(e->len) > 0 && xint(e->lbn) + xint(e->len) == fbn &&
+       xint(e->start) + xint(e->len) == freeblock){
+      e->len = xint(xint(e->len) + 1);
+      return freeblock++;
+    }
+  }
+  for(e = din->extents; e < &din->extents[NEXTENT]; e++){
+    if(xint(e->len) == 0){
+      e->lbn = xint(fbn);
+      e->start = xint(freeblock);
+      e->len = xint(1);
+      return freeblock++;
+    }
+  }
+  mid = xint(indirect(&din->dindirect, fbn / NINDIRECT, 1));
+  return indirect(&mid, fbn % NINDIRECT, 1);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -259,7 +306,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -267,23 +313,7 @@ iappend(uint inum, void *xp, int n)
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = ibmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -295,3 +325,39 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Add (name, inum) to the hashed directory dir,
+// in the same way as the kernel's dirlink().
+void
+dirappend(uint dir, char *name, uint inum)
+{
+  struct dinode din;
+  struct dirent de[DPB];
+  uint fbn, next, x;
+  int i;
+
+  rinode(dir, &din);
+  fbn = dirhash(name) % NDIRBUCKET;
+  for(;;){
+    x = ibmap(&din, fbn);
+    rsect(x, de);
+    for(i = 0; i < DPB-1; i++)
+      if(de[i].inum == 0)
+        goto found;
+    memmove(&next, de[DPB-1].name, sizeof(next));
+    if(xint(next) == 0){
+      next = xint(din.size) / BSIZE;
+      din.size = xint((next + 1) * BSIZE);
+      next = xint(next);
+      memmove(de[DPB-1].name, &next, sizeof(next));
+      wsect(x, de);
+    }
+    fbn = xint(next);
+  }
+
+found:
+  de[i].inum = xshort(inum);
+  strncpy(de[i].name, name, DIRSIZ);
+  wsect(x, de);
+  winode(dir, &din);
+}
@@ -11,6 +11,17 @@
 
 #define CR4_PSE         0x00000010      // Page size extension
 
+// Model-specific registers used by sysenter/sysexit.
+// sysenter loads CS from MSR_SYSENTER_CS and SS from the next
+// descriptor; sysexit uses the two after that, so SEG_KCODE,
+// SEG_KDATA, SEG_UCODE and SEG_UDATA must stay consecutive.
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+// cpuid(1) %edx feature bits
+#define CPUID_SEP       0x00000800      // sysenter/sysexit present
+
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
 #define SEG_KDATA 2  // kernel data+stack
@@ -95,6 +106,11 @@ struct segdesc {
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
 #define PTE_PS          0x080   // Page Size
+#define PTE_TEXT        0x200   // Software: shared page from the text cache
+
+// Page fault error code bits.
+#define FEC_PR          0x001   // Fault on a present page (protection)
+#define FEC_WR          0x002   // Fault on a write
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
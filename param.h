@@ -1,14 +1,22 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE       16  // open files per process before its table grows
+#define MAXOFILE   1024  // most open files per process (a page of pointers)
+#define NINODE       50  // fewest in-memory i-nodes
+#define MAXINODE   2048  // most in-memory i-nodes
+#define ICACHEPGS    16  // free pages of memory per in-memory i-node
+#define NIHASH      127  // i-node cache hash chains
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NSEG          4  // program segments exec() loads on demand
+#define NTEXTPG     256  // pages in the shared program text cache
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*6)  // max data blocks in on-disk log
+#define NBUF         (MAXOPBLOCKS*12)  // size of disk block cache
+#define NDELAY       32  // max file blocks waiting for allocation
+#define FLUSHTICKS   100  // max ticks a finished FS call waits to commit
+#define FSSIZE       16384  // size of file system in blocks
+#define NDCACHE      128  // directory name lookup cache entries
 
@@ -6,30 +6,64 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "share.h"
 #include "file.h"
+#include "uio.h"
 
-#define PIPESIZE 512
+// The pipe buffer is a ring of NPIPEPG pages, copied into
+// and out of a page-sized piece at a time.  When a reader
+// asks for a whole, page-aligned page of its own memory and
+// the ring holds exactly one full page there, piperead()
+// swaps the ring page into the reader's address space and
+// takes the reader's old page for the ring instead of
+// copying.
+#define NPIPEPG  4
+#define PIPESIZE (NPIPEPG*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *buf[NPIPEPG];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+static struct kmem_cache *pipecache;
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipecache", sizeof(struct pipe));
+}
+
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = 0; i < NPIPEPG; i++)
+    if(p->buf[i])
+      kfree(p->buf[i]);
+  kmem_cache_free(p);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *p;
+  int i;
 
   p = 0;
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((p = kmem_cache_alloc(pipecache)) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  for(i = 0; i < NPIPEPG; i++)
+    if((p->buf[i] = kalloc()) == 0)
+      goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -48,7 +82,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,19 +103,40 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
 
 //PAGEBREAK: 40
+// Copy as much of addr[0..n) into the ring as fits.
+// Caller holds p->lock.
+static int
+pipecopyin(struct pipe *p, char *addr, int n)
+{
+  int i, m, off;
+
+  for(i = 0; i < n && p->nwrite != p->nread + PIPESIZE; i += m){
+    // Copy as much as fits before the end of the ring page.
+    off = p->nwrite % PGSIZE;
+    m = n - i;
+    if(m > PGSIZE - off)
+      m = PGSIZE - off;
+    if(m > p->nread + PIPESIZE - p->nwrite)
+      m = p->nread + PIPESIZE - p->nwrite;
+    memmove(p->buf[p->nwrite % PIPESIZE / PGSIZE] + off, addr + i, m);
+    p->nwrite += m;
+  }
+  return i;
+}
+
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
   int i;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
+  for(i = 0; i < n; i += pipecopyin(p, addr + i, n - i)){
     while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
@@ -90,32 +145,150 @@ pipewrite(struct pipe *p, char *addr, int n)
       wakeup(&p->nread);
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
   }
   wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
 
+// Wait until p has room for more data.
+// Returns -1 if there is no longer a reader.
 int
-piperead(struct pipe *p, char *addr, int n)
+pipewait(struct pipe *p)
 {
-  int i;
-
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+  while(p->nwrite == p->nread + PIPESIZE && p->readopen){
     if(myproc()->killed){
       release(&p->lock);
       return -1;
     }
+    wakeup(&p->nread);
+    sleep(&p->nwrite, &p->lock);
+  }
+  if(p->readopen == 0){
+    release(&p->lock);
+    return -1;
+  }
+  release(&p->lock);
+  return 0;
+}
+
+// Write as much of addr[0..n) to p as fits without sleeping,
+// for callers that hold locks a reader might need.
+// Returns the number of bytes written, or -1 if there is no
+// longer a reader.
+int
+pipeput(struct pipe *p, char *addr, int n)
+{
+  int r;
+
+  acquire(&p->lock);
+  if(p->readopen == 0){
+    release(&p->lock);
+    return -1;
+  }
+  r = pipecopyin(p, addr, n);
+  wakeup(&p->nread);
+  release(&p->lock);
+  return r;
+}
+
+// Try to hand the full ring page at p->nread to the reader
+// at user address va, taking the page it replaces for the
+// ring.  Only private memory below sz qualifies, and only
+// when no other thread shares the page table, so no other
+// CPU can hold the old mapping in its TLB.
+static int
+pipeloan(struct pipe *p, char *va)
+{
+  struct proc *curproc = myproc();
+  char *old;
+  int pg;
+
+  if((uint)va % PGSIZE != 0 || p->nread % PGSIZE != 0 ||
+     p->nwrite - p->nread < PGSIZE ||
+     (uint)va + PGSIZE > curproc->sh->sz || vmrefs(curproc->pgdir) != 1)
+    return 0;
+  pg = p->nread % PIPESIZE / PGSIZE;
+  if((old = swapupage(curproc->pgdir, va, p->buf[pg])) == 0)
+    return 0;
+  p->buf[pg] = old;
+  p->nread += PGSIZE;
+  return 1;
+}
+
+// Copy as much of the ring as fits into addr[0..n).
+// Caller holds p->lock.
+static int
+pipecopyout(struct pipe *p, char *addr, int n)
+{
+  int i, m, off;
+
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    m = PGSIZE;
+    if(n - i >= PGSIZE && pipeloan(p, addr + i))
+      continue;
+    off = p->nread % PGSIZE;
+    m = n - i;
+    if(m > PGSIZE - off)
+      m = PGSIZE - off;
+    if(m > p->nwrite - p->nread)
+      m = p->nwrite - p->nread;
+    memmove(addr + i, p->buf[p->nread % PIPESIZE / PGSIZE] + off, m);
+    p->nread += m;
+  }
+  return i;
+}
+
+// Wait until p has data or no writer is left.
+// Caller holds p->lock.
+static int
+pipewaitdata(struct pipe *p)
+{
+  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+    if(myproc()->killed)
+      return -1;
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  return 0;
+}
+
+int
+piperead(struct pipe *p, char *addr, int n)
+{
+  int i;
+
+  acquire(&p->lock);
+  if(pipewaitdata(p) < 0){
+    release(&p->lock);
+    return -1;
   }
+  i = pipecopyout(p, addr, n);
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
   return i;
 }
+
+// Like piperead, but scatter into cnt buffers.  Waits only
+// once, so it returns whatever was in the pipe.
+int
+pipereadv(struct pipe *p, struct iovec *iov, int cnt)
+{
+  int i, n, r;
+
+  acquire(&p->lock);
+  if(pipewaitdata(p) < 0){
+    release(&p->lock);
+    return -1;
+  }
+  n = 0;
+  for(i = 0; i < cnt && p->nread != p->nwrite; i++){
+    r = pipecopyout(p, iov[i].base, iov[i].len);
+    n += r;
+    if(r < iov[i].len)
+      break;
+  }
+  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  release(&p->lock);
+  return n;
+}
@@ -2,14 +2,32 @@
 #include "stat.h"
 #include "user.h"
 
+// Output is gathered here and written with one write(),
+// or one per sizeof(buf) bytes for long output.
+struct outbuf {
+  int fd;
+  int n;
+  char buf[128];
+};
+
+static void
+flush(struct outbuf *out)
+{
+  if(out->n > 0)
+    write(out->fd, out->buf, out->n);
+  out->n = 0;
+}
+
 static void
-putc(int fd, char c)
+putc(struct outbuf *out, char c)
 {
-  write(fd, &c, 1);
+  if(out->n == sizeof(out->buf))
+    flush(out);
+  out->buf[out->n++] = c;
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct outbuf *out, int xx, int base, int sgn)
 {
   static char digits[] = "0123456789ABCDEF";
   char buf[16];
@@ -32,17 +50,20 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(out, buf[i]);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
 void
 printf(int fd, const char *fmt, ...)
 {
+  struct outbuf out;
   char *s;
   int c, i, state;
   uint *ap;
 
+  out.fd = fd;
+  out.n = 0;
   state = 0;
   ap = (uint*)(void*)&fmt + 1;
   for(i = 0; fmt[i]; i++){
@@ -51,14 +72,14 @@ printf(int fd, const char *fmt, ...)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(&out, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, *ap, 10, 1);
+        printint(&out, *ap, 10, 1);
         ap++;
       } else if(c == 'x' || c == 'p'){
-        printint(fd, *ap, 16, 0);
+        printint(&out, *ap, 16, 0);
         ap++;
       } else if(c == 's'){
         s = (char*)*ap;
@@ -66,20 +87,21 @@ printf(int fd, const char *fmt, ...)
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(&out, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, *ap);
+        putc(&out, *ap);
         ap++;
       } else if(c == '%'){
-        putc(fd, c);
+        putc(&out, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(&out, '%');
+        putc(&out, c);
       }
       state = 0;
     }
   }
+  flush(&out);
 }
@@ -6,7 +6,10 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "share.h"
 #include "wmap.h"
+#include "futex.h"
 
 struct
 {
@@ -15,6 +18,7 @@ struct
 } ptable;
 
 static struct proc *initproc;
+static struct kmem_cache *sharecache;
 
 int nextpid = 1;
 extern void forkret(void);
@@ -25,6 +29,7 @@ static void wakeup1(void *chan);
 void pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  sharecache = kmem_cache_create("sharecache", sizeof(struct share));
 }
 
 // Must be called with interrupts disabled
@@ -94,6 +99,8 @@ found:
 
   release(&ptable.lock);
 
+  p->sh = 0;
+
   // Allocate kernel stack.
   if ((p->kstack = kalloc()) == 0)
   {
@@ -119,6 +126,141 @@ found:
   return p;
 }
 
+// Give sh a descriptor table of MAXOFILE entries in place of
+// its built-in one.  Returns -1 if it has one already or
+// memory is short.  Caller must hold sh->flock if other
+// threads can see sh.
+int ofilegrow(struct share *sh)
+{
+  struct file **ofile;
+
+  if (sh->nofile == MAXOFILE || (ofile = (struct file **)kalloc()) == 0)
+    return -1;
+  memset(ofile, 0, PGSIZE);
+  memmove(ofile, sh->ofile, sh->nofile * sizeof(ofile[0]));
+  sh->ofile = ofile;
+  sh->nofile = MAXOFILE;
+  return 0;
+}
+
+// Return a new reference to the file open as fd in sh, or 0.
+// The caller closes it when done.
+struct file *ofileget(struct share *sh, int fd)
+{
+  struct file *f = 0;
+
+  acquire(&sh->flock);
+  if (fd >= 0 && fd < sh->nofile && sh->ofile[fd])
+    f = filedup(sh->ofile[fd]);
+  release(&sh->flock);
+  return f;
+}
+
+// Allocate a share with no memory and no open files.
+static struct share *sharealloc(void)
+{
+  struct share *sh;
+
+  if ((sh = kmem_cache_alloc(sharecache)) == 0)
+    return 0;
+  memset(sh, 0, sizeof(*sh));
+  sh->ref = 1;
+  initsleeplock(&sh->lock, "share");
+  initlock(&sh->flock, "ofile");
+  sh->ofile = sh->ofile0;
+  sh->nofile = NOFILE;
+  return sh;
+}
+
+// Close sh's files and free it.  No thread may use it any
+// more, and its regions must be unmapped.
+static void sharefree(struct share *sh)
+{
+  int fd;
+
+  for (fd = 0; fd < sh->nofile; fd++)
+    if (sh->ofile[fd])
+      fileclose(sh->ofile[fd]);
+  if (sh->ofile != sh->ofile0)
+    kfree((char *)sh->ofile);
+  kmem_cache_free(sh);
+}
+
+// Allocate a share with no memory and a copy of sh's
+// descriptor table.
+static struct share *sharecopy(struct share *sh)
+{
+  struct share *nsh;
+  int fd;
+
+  if ((nsh = sharealloc()) == 0)
+    return 0;
+  acquire(&sh->flock);
+  if (sh->nofile > nsh->nofile && ofilegrow(nsh) < 0)
+  {
+    release(&sh->flock);
+    sharefree(nsh);
+    return 0;
+  }
+  for (fd = 0; fd < sh->nofile; fd++)
+    if (sh->ofile[fd])
+      nsh->ofile[fd] = filedup(sh->ofile[fd]);
+  nsh->fdfree = sh->fdfree;
+  release(&sh->flock);
+  return nsh;
+}
+
+// Give p a share of its own, with a copy of its open files, if
+// other threads use its share; exec() leaves them the old image.
+// Returns -1 if memory is short.
+int shareown(struct proc *p)
+{
+  struct share *sh = p->sh, *nsh;
+
+  // Only p could add a thread to a share it alone uses.
+  if (sh->ref == 1)
+    return 0;
+  if ((nsh = sharecopy(sh)) == 0)
+    return -1;
+  acquire(&ptable.lock);
+  if (sh->ref > 1)
+  {
+    sh->ref--;
+    p->sh = nsh;
+    nsh = 0;
+  }
+  release(&ptable.lock);
+  if (nsh)
+    sharefree(nsh); // The other threads exited meanwhile.
+  return 0;
+}
+
+// Start a kernel process that runs fn, which must not return.
+// It has a page table but no user memory, and never exits.
+int kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if ((p = allocproc()) == 0)
+    return -1;
+  if ((p->pgdir = setupkvm()) == 0)
+  {
+    kfree(p->kstack);
+    p->kstack = 0;
+    p->state = UNUSED;
+    return -1;
+  }
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  // forkret() "returns" to fn instead of trapret.
+  *(uint *)(p->context + 1) = (uint)fn;
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+  return p->pid;
+}
+
 // PAGEBREAK: 32
 //  Set up first user process.
 void userinit(void)
@@ -129,10 +271,11 @@ void userinit(void)
   p = allocproc();
 
   initproc = p;
-  if ((p->pgdir = setupkvm()) == 0)
+  if ((p->pgdir = setupkvm()) == 0 || (p->sh = sharealloc()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
-  p->sz = PGSIZE;
+  p->sh->sz = PGSIZE;
+  p->heapbase = PGSIZE;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -157,26 +300,42 @@ void userinit(void)
 }
 
 // Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Return the old size on success, -1 on failure.
 int growproc(int n)
 {
-  uint sz;
+  uint sz, oldsz;
   struct proc *curproc = myproc();
+  struct share *sh = curproc->sh;
 
-  sz = curproc->sz;
+  // Threads sharing sh must not both grow it from the same size.
+  acquiresleep(&sh->lock);
+  sz = oldsz = sh->sz;
   if (n > 0)
   {
-    if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the address space: pagein() zero-fills each
+    // page on first touch.  Refuse growth that the memory free
+    // right now could not back, so that malloc() still fails
+    // cleanly instead of the process dying on a later fault.
+    if (sz + n < sz || sz + n >= KERNBASE || region_overlaps(curproc, sz, n) ||
+        (PGROUNDUP(sz + n) - PGROUNDUP(sz)) / PGSIZE > kfreepages())
+    {
+      releasesleep(&sh->lock);
       return -1;
+    }
+    sz += n;
   }
   else if (n < 0)
   {
     if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    {
+      releasesleep(&sh->lock);
       return -1;
+    }
   }
-  curproc->sz = sz;
+  sh->sz = sz;
+  releasesleep(&sh->lock);
   switchuvm(curproc);
-  return 0;
+  return oldsz;
 }
 
 // Create a new process copying p as the parent.
@@ -187,35 +346,59 @@ int fork(void)
   int i, pid;
   struct proc *np;
   struct proc *curproc = myproc();
+  struct share *sh = curproc->sh;
 
   // Allocate process.
   if ((np = allocproc()) == 0)
   {
     return -1;
   }
+  if ((np->sh = sharecopy(sh)) == 0)
+  {
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
 
-  // Copy process state from proc.
-  if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0)
+  // Copy process state from proc.  Other threads must not
+  // change the size or the regions while they are copied.
+  acquiresleep(&sh->lock);
+  if ((np->pgdir = copyuvm(curproc->pgdir, sh->sz)) == 0)
   {
+    releasesleep(&sh->lock);
+    sharefree(np->sh);
+    np->sh = 0;
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
-  np->sz = curproc->sz;
+  np->sh->sz = sh->sz;
   np->parent = curproc;
   *np->tf = *curproc->tf;
   np->tf->eax = 0;
 
   // Copy over all mappings from parent to child
-  for (int i = 0; i < 16; i++)
+  for (i = 0; i < 16; i++)
   {
-    np->wmap_regions[i] = curproc->wmap_regions[i];
+    np->sh->wmap_regions[i] = sh->wmap_regions[i];
 
-    if (!np->wmap_regions[i])
+    if (!np->sh->wmap_regions[i])
       continue;
 
-    struct wmap_region *wmap_region = np->wmap_regions[i];
+    struct wmap_region *wmap_region = np->sh->wmap_regions[i];
+
+    // A private mapping gets its own region, freed by its own wunmap.
+    if (wmap_region->flags & MAP_PRIVATE)
+    {
+      if ((np->sh->wmap_regions[i] = wmapregionalloc()) == 0)
+      {
+        cprintf("out of memory\n");
+        goto bad;
+      }
+      *np->sh->wmap_regions[i] = *wmap_region;
+    }
 
     pte_t *pt_entry;
     uint addr = wmap_region->addr;
@@ -237,7 +420,7 @@ int fork(void)
         if ((mem = kalloc()) == 0)
         {
           cprintf("out of memory\n");
-          return -1;
+          goto bad;
         }
 
         memmove(mem, (char *)P2V(parent), PGSIZE);
@@ -246,106 +429,204 @@ int fork(void)
       if (mappages(np->pgdir, (char *)addr, PGSIZE, V2P(mem), PTE_W | PTE_U) < 0)
       {
         cprintf("out of memory (2)\n");
-        kfree(mem);
-        return -1;
+        if (wmap_region->flags & MAP_PRIVATE)
+          kfree(mem);
+        goto bad;
       }
     }
   }
 
   acquire(&ptable.lock);
-  // Increase reference counts for shared mapping across forked processes.
-  struct proc *p2;
-  for (p2 = ptable.proc; p2 < &ptable.proc[NPROC]; p2++)
+  // The child holds one more reference to each region it shares
+  // with the parent; wunmap() drops it.
+  for (i = 0; i < 16; i++)
+    if (np->sh->wmap_regions[i] && !(np->sh->wmap_regions[i]->flags & MAP_PRIVATE))
+      np->sh->wmap_regions[i]->ref_count++;
+  release(&ptable.lock);
+  releasesleep(&sh->lock);
+
+  np->cwd = idup(curproc->cwd);
+  np->exe = curproc->exe ? idup(curproc->exe) : 0;
+  if (np->exe)
+    iexec(np->exe, 1);
+  memmove(np->seg, curproc->seg, sizeof(np->seg));
+  np->nseg = curproc->nseg;
+  np->heapbase = curproc->heapbase;
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  pid = np->pid;
+  acquire(&ptable.lock);
+  np->state = RUNNABLE;
+  release(&ptable.lock);
+  return pid;
+
+bad:
+  // Undo the region copies made so far, up to slot i: the child's
+  // private regions and their pages are its own, but shared pages
+  // are the parent's.
+  for (; i >= 0; i--)
   {
-    if (p2 != curproc && p2->parent != curproc)
+    struct wmap_region *r = np->sh->wmap_regions[i];
+    if (r == 0)
       continue;
+    unmaprange(np->pgdir, r->addr, r->addr + r->length, r->flags & MAP_PRIVATE);
+    if (r->flags & MAP_PRIVATE)
+      kmem_cache_free(r);
+    np->sh->wmap_regions[i] = 0;
+  }
+  releasesleep(&sh->lock);
+  freevm(np->pgdir);
+  np->pgdir = 0;
+  sharefree(np->sh);
+  np->sh = 0;
+  kfree(np->kstack);
+  np->kstack = 0;
+  np->state = UNUSED;
+  return -1;
+}
 
-    for (int i = 0; i < 16; i++)
-    {
-      if (p2->wmap_regions[i] == 0)
-        continue;
+// Create a new thread that shares the current process's address
+// space, wmap regions and open files. The thread starts running
+// fcn(arg1, arg2) on the one-page user stack at stack, which must
+// be page-aligned. The working directory is duplicated as in
+// fork(). Returns the pid of the new thread, or -1.
+int clone(void (*fcn)(void *, void *), void *arg1, void *arg2, void *stack)
+{
+  int pid;
+  uint sp, ustack[3];
+  struct proc *np;
+  struct proc *curproc = myproc();
 
-      struct wmap_region *wmap_region = p2->wmap_regions[i];
+  if ((uint)stack % PGSIZE != 0 || (uint)stack + PGSIZE > curproc->sh->sz ||
+      prefault(curproc, (uint)stack, PGSIZE) < 0)
+    return -1;
 
-      if (wmap_region->flags & MAP_SHARED)
-        wmap_region->ref_count++;
-    }
-  }
+  // Allocate process.
+  if ((np = allocproc()) == 0)
+    return -1;
 
-  release(&ptable.lock);
+  // Share the address space instead of copying it.
+  np->pgdir = curproc->pgdir;
+  np->parent = curproc;
+  np->ustack = stack;
+  *np->tf = *curproc->tf;
+
+  // Build the initial user stack: fake return PC and two arguments.
+  ustack[0] = 0xffffffff;
+  ustack[1] = (uint)arg1;
+  ustack[2] = (uint)arg2;
+  sp = (uint)stack + PGSIZE - sizeof(ustack);
+  if (copyout(np->pgdir, sp, ustack, sizeof(ustack)) < 0)
+  {
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->pgdir = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->tf->esp = sp;
+  np->tf->eip = (uint)fcn;
 
-  for (i = 0; i < NOFILE; i++)
-    if (curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  np->exe = curproc->exe ? idup(curproc->exe) : 0;
+  if (np->exe)
+    iexec(np->exe, 1);
+  memmove(np->seg, curproc->seg, sizeof(np->seg));
+  np->nseg = curproc->nseg;
+  np->heapbase = curproc->heapbase;
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
   pid = np->pid;
   acquire(&ptable.lock);
+  np->sh = curproc->sh;
+  np->sh->ref++;
   np->state = RUNNABLE;
   release(&ptable.lock);
   return pid;
 }
 
+// Drop a process's reference to wmap region r.  Returns 1 if it
+// was the last, and the caller must free r and its pages.
+int wmaprelease(struct wmap_region *r)
+{
+  int last;
+
+  if (r->flags & MAP_PRIVATE)
+    return 1;
+  acquire(&ptable.lock);
+  last = --r->ref_count == 0;
+  release(&ptable.lock);
+  return last;
+}
+
+// Count the processes other than UNUSED ones using pgdir.
+// The ptable lock must be held.
+static int
+vmrefs1(pde_t *pgdir)
+{
+  struct proc *p;
+  int n;
+
+  n = 0;
+  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if (p->state != UNUSED && p->pgdir == pgdir)
+      n++;
+  return n;
+}
+
+// Count the processes sharing the address space pgdir.
+int vmrefs(pde_t *pgdir)
+{
+  int n;
+
+  acquire(&ptable.lock);
+  n = vmrefs1(pgdir);
+  release(&ptable.lock);
+  return n;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
 void exit(void)
 {
   struct proc *curproc = myproc();
+  struct share *sh = curproc->sh;
   struct proc *p;
-  int fd;
+  int last;
 
   if (curproc == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for (fd = 0; fd < NOFILE; fd++)
+  // Other threads still running keep using the memory, regions
+  // and files; the last one out unmaps and closes them.  Unmap
+  // first, since writing back a shared file mapping needs its
+  // descriptor.
+  acquire(&ptable.lock);
+  last = --sh->ref == 0;
+  release(&ptable.lock);
+  if (last)
   {
-    if (curproc->ofile[fd])
-    {
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
-    }
+    acquiresleep(&sh->lock);
+    for (int i = 0; i < 16; i++)
+      if (sh->wmap_regions[i])
+        wunmap(sh->wmap_regions[i]->addr);
+    releasesleep(&sh->lock);
+    sharefree(sh);
   }
+  curproc->sh = 0;
 
   begin_op();
   iput(curproc->cwd);
+  if (curproc->exe)
+  {
+    iexec(curproc->exe, -1);
+    iput(curproc->exe);
+  }
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   acquire(&ptable.lock);
 
-  // Invalidate pte entries and decrement ref counts for shared mappings
-  for (int i = 0; i < 16; i++)
-  {
-    if (curproc->wmap_regions[i] == 0)
-      continue;
-
-    struct wmap_region *wmap_region = curproc->wmap_regions[i];
-
-    uint addr = wmap_region->addr;
-    uint end = PGROUNDUP(wmap_region->addr + wmap_region->length);
-
-    for (; addr < end; addr += PGSIZE)
-    {
-      pte_t *pt_entry;
-      if ((pt_entry = walkpgdir(curproc->pgdir, (char *)addr, 0)) == 0)
-        continue;
-
-      *pt_entry &= ~PTE_P;
-    }
-
-    if (wmap_region->flags & MAP_SHARED)
-    {
-      wmap_region->ref_count--;
-      if (wmap_region->ref_count == 0)
-      {
-        // Unmap the shared memory region
-        wunmap(wmap_region->addr);
-      }
-    }
-  }
-
   // cprintf("Process %d exited\n", curproc->pid);
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
@@ -382,7 +663,7 @@ int wait(void)
     havekids = 0;
     for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
     {
-      if (p->parent != curproc)
+      if (p->parent != curproc || p->pgdir == curproc->pgdir)
         continue;
       havekids = 1;
       if (p->state == ZOMBIE)
@@ -391,7 +672,11 @@ int wait(void)
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
-        freevm(p->pgdir);
+        p->state = UNUSED;
+        if (vmrefs1(p->pgdir) == 0)
+          freevm(p->pgdir);
+        p->pgdir = 0;
+        p->ustack = 0;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
@@ -414,6 +699,55 @@ int wait(void)
   }
 }
 
+// Wait for a child thread (one created by clone() and sharing this
+// address space) to exit. Stores its user stack in *stack so the
+// caller can free it, and returns its pid, or -1 if there are none.
+int join(void **stack)
+{
+  struct proc *p;
+  int havekids, pid;
+  struct proc *curproc = myproc();
+
+  acquire(&ptable.lock);
+  for (;;)
+  {
+    // Scan through table looking for exited threads.
+    havekids = 0;
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    {
+      if (p->parent != curproc || p->pgdir != curproc->pgdir)
+        continue;
+      havekids = 1;
+      if (p->state == ZOMBIE)
+      {
+        // Found one. The address space is still ours; don't free it.
+        pid = p->pid;
+        *stack = p->ustack;
+        kfree(p->kstack);
+        p->kstack = 0;
+        p->pgdir = 0;
+        p->ustack = 0;
+        p->pid = 0;
+        p->parent = 0;
+        p->name[0] = 0;
+        p->killed = 0;
+        p->state = UNUSED;
+        release(&ptable.lock);
+        return pid;
+      }
+    }
+
+    // No point waiting if we don't have any threads.
+    if (!havekids || curproc->killed)
+    {
+      release(&ptable.lock);
+      return -1;
+    }
+
+    sleep(curproc, &ptable.lock);
+  }
+}
+
 // PAGEBREAK: 42
 //  Per-CPU process scheduler.
 //  Each CPU calls scheduler() after setting itself up.
@@ -508,6 +842,9 @@ void forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    ballocinit(ROOTDEV);
+    if (kproc("logflusher", logflusher) < 0)
+      panic("forkret: logflusher");
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -574,6 +911,68 @@ void wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Wait on or wake the user word at addr. Waiters are keyed on the
+// kernel address of the physical word, so processes that share the
+// page (threads, or MAP_SHARED regions across fork) meet on the same
+// channel. FUTEX_WAIT sleeps only if the word still equals val and
+// returns 0 when woken; FUTEX_WAKE wakes at most val waiters and
+// returns how many it woke.
+int futex(uint addr, int op, int val)
+{
+  struct proc *curproc = myproc();
+  struct proc *p;
+  pte_t *pte;
+  int *kaddr, n;
+
+  if (addr % sizeof(int) != 0 || addr >= KERNBASE)
+    return -1;
+
+  // Fault in a not-yet-touched wmap or program page now; we can't take
+  // a page fault while holding ptable.lock below.
+  if (addr >= curproc->sh->sz && region_overlaps(curproc, addr, sizeof(int)))
+    (void)*(volatile int *)addr;
+  if (addr < curproc->sh->sz && prefault(curproc, addr, sizeof(int)) < 0)
+    return -1;
+
+  acquire(&ptable.lock);
+  pte = walkpgdir(curproc->pgdir, (char *)addr, 0);
+  if (pte == 0 || (*pte & (PTE_P | PTE_U)) != (PTE_P | PTE_U))
+  {
+    release(&ptable.lock);
+    return -1;
+  }
+  kaddr = (int *)(P2V(PTE_ADDR(*pte)) + (addr - PGROUNDDOWN(addr)));
+
+  switch (op)
+  {
+  case FUTEX_WAIT:
+    // Holding ptable.lock, so no wakeup can slip in between
+    // the comparison and the sleep.
+    if (*kaddr != val || curproc->killed)
+    {
+      release(&ptable.lock);
+      return -1;
+    }
+    sleep(kaddr, &ptable.lock);
+    release(&ptable.lock);
+    return 0;
+  case FUTEX_WAKE:
+    n = 0;
+    for (p = ptable.proc; p < &ptable.proc[NPROC] && n < val; p++)
+    {
+      if (p->state == SLEEPING && p->chan == kaddr)
+      {
+        p->state = RUNNABLE;
+        n++;
+      }
+    }
+    release(&ptable.lock);
+    return n;
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
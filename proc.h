@@ -8,6 +8,8 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  uint tlbsent;                // TLB shootdown IPIs sent
+  uint tlbrecv;                // TLB shootdowns answered
 };
 
 extern struct cpu cpus[NCPU];
@@ -41,11 +43,24 @@ struct wmap_region {
     int ref_count;
 };
 
+// A piece of the program image that exec() left to be read in
+// a page at a time on first touch.  Pages in [start, end) are
+// zero apart from the file bytes [off, off+filesz), which
+// belong at vaddr.
+struct vmseg {
+  uint start;
+  uint end;
+  uint vaddr;
+  uint off;
+  uint filesz;
+  int writable;
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
-  uint sz;                     // Size of process memory (bytes)
+  struct share *sh;            // Memory size, regions, open files
   pde_t* pgdir;                // Page table
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // Process state
@@ -55,10 +70,13 @@ struct proc {
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
-  struct wmap_region *wmap_regions[16]; // Memory mapped regions
+  void *ustack;                // User stack passed to clone() (threads only)
+  struct inode *exe;           // Program image, for demand paging
+  struct vmseg seg[NSEG];      // Parts of exe not yet read in
+  int nseg;                    // Number of entries in seg
+  uint heapbase;               // Start of the sbrk() heap
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,14 @@
+// What the threads of a process share: clone() gives a new
+// thread its creator's, fork() gives a child a copy.
+// Needs spinlock.h and sleeplock.h.
+struct share {
+  int ref;                     // Threads using it; under ptable.lock
+  struct sleeplock lock;       // Held to change sz or wmap_regions
+  uint sz;                     // Size of process memory (bytes)
+  struct wmap_region *wmap_regions[16]; // Memory mapped regions
+  struct spinlock flock;       // Protects the descriptor table
+  struct file **ofile;         // Open files: ofile0, or a page of MAXOFILE
+  int nofile;                  // Entries in ofile
+  int fdfree;                  // Every fd below this is in use
+  struct file *ofile0[NOFILE]; // Built-in descriptor table
+};
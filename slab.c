@@ -0,0 +1,167 @@
+// Slab allocator for small fixed-size kernel objects.
+//
+// Each cache hands out objects of one size, carved from whole
+// pages got from kalloc().  A page (a slab) starts with a
+// struct slab and holds as many objects as fit after it; its
+// free objects are chained through their first word.  A cache
+// keeps its slabs that have free objects on a list, so
+// allocating and freeing take constant time.  A slab whose
+// objects are all free goes back to kalloc(), unless it is the
+// cache's last one.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "memstat.h"
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;    // next slab on cache's partial list
+  void *free;           // first free object
+  int inuse;            // objects handed out
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;            // object size
+  struct spinlock lock;
+  struct slab *partial; // slabs with free objects
+  uint nslab;           // slabs (pages) held
+  uint inuse;           // objects handed out
+  uint nalloc;          // allocations since boot
+};
+
+static struct {
+  struct spinlock lock;
+  struct kmem_cache cache[MEMSTAT_NCACHE];
+  int n;
+} caches;
+
+void
+slabinit(void)
+{
+  initlock(&caches.lock, "caches");
+}
+
+// Make a cache of objects of size bytes.  Caches last forever.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  if(size < sizeof(void*))
+    size = sizeof(void*);
+  size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+  if(size > PGSIZE - sizeof(struct slab))
+    panic("kmem_cache_create: too big");
+  acquire(&caches.lock);
+  if(caches.n == MEMSTAT_NCACHE)
+    panic("kmem_cache_create: too many");
+  c = &caches.cache[caches.n];
+  c->name = name;
+  c->size = size;
+  initlock(&c->lock, name);
+  caches.n++;  // visible to kmem_cache_stat() only now
+  release(&caches.lock);
+  return c;
+}
+
+// Carve a fresh page into a slab for c.
+static struct slab*
+newslab(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *p, *end;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  end = (char*)s + PGSIZE;
+  for(p = (char*)(s + 1); p + c->size <= end; p += c->size){
+    *(void**)p = s->free;
+    s->free = p;
+  }
+  return s;
+}
+
+// Allocate an object from c.  Returns 0 if memory is short.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct slab *s;
+  void *p;
+
+  acquire(&c->lock);
+  if((s = c->partial) == 0){
+    if((s = newslab(c)) == 0){
+      release(&c->lock);
+      return 0;
+    }
+    s->next = 0;
+    c->partial = s;
+    c->nslab++;
+  }
+  p = s->free;
+  s->free = *(void**)p;
+  s->inuse++;
+  if(s->free == 0)
+    c->partial = s->next;
+  c->inuse++;
+  c->nalloc++;
+  release(&c->lock);
+  return p;
+}
+
+// Return p to the cache it came from.
+void
+kmem_cache_free(void *p)
+{
+  struct slab *s, **sp;
+  struct kmem_cache *c;
+
+  s = (struct slab*)PGROUNDDOWN((uint)p);
+  c = s->cache;
+  acquire(&c->lock);
+  if(s->free == 0){
+    // It was full: it has room again.
+    s->next = c->partial;
+    c->partial = s;
+  }
+  *(void**)p = s->free;
+  s->free = p;
+  s->inuse--;
+  c->inuse--;
+  if(s->inuse == 0 && c->nslab > 1){
+    for(sp = &c->partial; *sp != s; sp = &(*sp)->next)
+      ;
+    *sp = s->next;
+    c->nslab--;
+    kfree((char*)s);
+  }
+  release(&c->lock);
+}
+
+void
+kmem_cache_stat(struct memstat *st)
+{
+  struct kmem_cache *c;
+  int i;
+
+  acquire(&caches.lock);
+  st->ncache = caches.n;
+  release(&caches.lock);
+  for(i = 0; i < st->ncache; i++){
+    c = &caches.cache[i];
+    acquire(&c->lock);
+    safestrcpy(st->cache[i].name, c->name, sizeof(st->cache[i].name));
+    st->cache[i].size = c->size;
+    st->cache[i].inuse = c->inuse;
+    st->cache[i].slabs = c->nslab;
+    st->cache[i].allocs = c->nalloc;
+    release(&c->lock);
+  }
+}
@@ -17,17 +17,30 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->class = lockclass(name, 1);
+  lk->tacquire = 0;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  unsigned long long t0;
+  int contended;
+
   acquire(&lk->lk);
+  t0 = 0;
+  contended = lk->locked;
+  if (contended && lockstaton)
+    t0 = rdtsc();
   while (lk->locked) {
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  if (lockstaton && lk->class) {
+    lockstatacquire(lk->class, contended, t0 ? rdtsc() - t0 : 0);
+    lk->tacquire = (uint)rdtsc();
+  }
   release(&lk->lk);
 }
 
@@ -35,6 +48,11 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  if (lk->tacquire) {
+    if (lockstaton && lk->class)
+      lockstatrelease(lk->class, lk->tacquire);
+    lk->tacquire = 0;
+  }
   lk->locked = 0;
   lk->pid = 0;
   wakeup(lk);
@@ -6,5 +6,9 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+  // For lockstat:
+  struct lockclass *class; // Statistics for locks with this name.
+  uint tacquire;           // Low bits of rdtsc when acquired.
 };
 
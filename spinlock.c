@@ -8,6 +8,117 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "lockstat.h"
+
+// Lock classes for lockstat, one per distinct lock name.
+// The table is filled in by initlock() and initsleeplock(),
+// which may run before mycpu() works, so it is protected by
+// a bare xchg lock with interrupts off instead of a spinlock.
+#define NLOCKCLASS MAX_LOCKSTAT
+static struct lockclass lockclasses[NLOCKCLASS];
+static uint lockclasslock;
+int lockstaton;
+
+// Find or create the statistics class for locks named name.
+// Returns 0 if the table is full; such locks aren't tracked.
+struct lockclass*
+lockclass(char *name, int sleeplock)
+{
+  struct lockclass *c;
+  uint eflags;
+
+  eflags = readeflags();
+  cli();
+  while(xchg(&lockclasslock, 1) != 0)
+    ;
+  for(c = lockclasses; c < &lockclasses[NLOCKCLASS]; c++){
+    if(c->name == 0){
+      c->name = name;
+      c->sleeplock = sleeplock;
+      break;
+    }
+    if(c->sleeplock == sleeplock && strncmp(c->name, name, 16) == 0)
+      break;
+  }
+  xchg(&lockclasslock, 0);
+  if(eflags & FL_IF)
+    sti();
+  if(c == &lockclasses[NLOCKCLASS])
+    return 0;
+  return c;
+}
+
+// Charge one acquisition to c, which waited wait cycles.
+// Interrupts must be off.
+void
+lockstatacquire(struct lockclass *c, int contended, unsigned long long wait)
+{
+  int id;
+
+  id = cpuid();
+  c->cpu[id].acquires++;
+  if(contended){
+    c->cpu[id].contended++;
+    c->cpu[id].waitcycles += wait;
+  }
+}
+
+// Record a hold time that started at tacquire.
+// Interrupts must be off.
+void
+lockstatrelease(struct lockclass *c, uint tacquire)
+{
+  uint hold;
+  int id;
+
+  hold = (uint)rdtsc() - tacquire;
+  id = cpuid();
+  if(hold > c->cpu[id].maxhold)
+    c->cpu[id].maxhold = hold;
+}
+
+// Control and report lock statistics.
+int
+lockstat(int cmd, struct lockstat *st)
+{
+  struct lockclass *c;
+  unsigned long long wait;
+  int i, n;
+
+  switch(cmd){
+  case LOCKSTAT_ENABLE:
+    lockstaton = 1;
+    return 0;
+  case LOCKSTAT_DISABLE:
+    lockstaton = 0;
+    return 0;
+  case LOCKSTAT_RESET:
+    for(c = lockclasses; c < &lockclasses[NLOCKCLASS]; c++)
+      memset(c->cpu, 0, sizeof(c->cpu));
+    return 0;
+  case LOCKSTAT_GET:
+    memset(st, 0, sizeof(*st));
+    st->enabled = lockstaton;
+    n = 0;
+    for(c = lockclasses; c < &lockclasses[NLOCKCLASS] && c->name; c++){
+      safestrcpy(st->name[n], c->name, sizeof(st->name[n]));
+      st->sleeplock[n] = c->sleeplock;
+      wait = 0;
+      for(i = 0; i < ncpu; i++){
+        st->acquires[n] += c->cpu[i].acquires;
+        st->contended[n] += c->cpu[i].contended;
+        wait += c->cpu[i].waitcycles;
+        if(c->cpu[i].maxhold > st->maxhold[n])
+          st->maxhold[n] = c->cpu[i].maxhold;
+      }
+      st->kcycles[n] = wait >> 10;
+      n++;
+    }
+    st->nlocks = n;
+    return 0;
+  }
+  return -1;
+}
 
 void
 initlock(struct spinlock *lk, char *name)
@@ -15,6 +126,8 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->class = lockclass(name, 0);
+  lk->tacquire = 0;
 }
 
 // Acquire the lock.
@@ -24,13 +137,23 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  unsigned long long t0;
+  int contended;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
   // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  t0 = 0;
+  contended = 0;
+  if(xchg(&lk->locked, 1) != 0){
+    contended = 1;
+    if(lockstaton)
+      t0 = rdtsc();
+    while(xchg(&lk->locked, 1) != 0)
+      tlbpoll();  // the holder may be waiting for us to flush
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +163,11 @@ acquire(struct spinlock *lk)
   // Record info about lock acquisition for debugging.
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+
+  if(lockstaton && lk->class){
+    lockstatacquire(lk->class, contended, t0 ? rdtsc() - t0 : 0);
+    lk->tacquire = (uint)rdtsc();
+  }
 }
 
 // Release the lock.
@@ -49,6 +177,12 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  if(lk->tacquire){
+    if(lockstaton && lk->class)
+      lockstatrelease(lk->class, lk->tacquire);
+    lk->tacquire = 0;
+  }
+
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
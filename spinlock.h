@@ -1,3 +1,16 @@
+// Contention statistics for all locks sharing a name,
+// kept per CPU so that recording needs no shared writes.
+struct lockclass {
+  char *name;
+  int sleeplock;
+  struct {
+    uint acquires;
+    uint contended;
+    uint maxhold;
+    unsigned long long waitcycles;
+  } cpu[NCPU];
+};
+
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
@@ -7,5 +20,9 @@ struct spinlock {
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+
+  // For lockstat:
+  struct lockclass *class; // Statistics for locks with this name.
+  uint tacquire;           // Low bits of rdtsc when acquired.
 };
 
@@ -4,8 +4,12 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "share.h"
 #include "x86.h"
 #include "syscall.h"
+#include "sysstat.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -19,7 +23,9 @@ fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(addr >= curproc->sh->sz || addr+4 > curproc->sh->sz)
+    return -1;
+  if(prefault(curproc, addr, 4) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -34,11 +40,13 @@ fetchstr(uint addr, char **pp)
   char *s, *ep;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  if(addr >= curproc->sh->sz)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
+  ep = (char*)curproc->sh->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && prefault(curproc, (uint)s, 1) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -63,7 +71,9 @@ argptr(int n, char **pp, int size)
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (uint)i >= curproc->sh->sz || (uint)i+size > curproc->sh->sz)
+    return -1;
+  if(prefault(curproc, i, size) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -108,6 +118,19 @@ extern int sys_wunmap(void);
 extern int sys_wremap(void);
 extern int sys_getwmapinfo(void);
 extern int sys_getpgdirinfo(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futex(void);
+extern int sys_sysstat(void);
+extern int sys_lockstat(void);
+extern int sys_fsstat(void);
+extern int sys_sync(void);
+extern int sys_splice(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_memstat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -136,17 +159,120 @@ static int (*syscalls[])(void) = {
 [SYS_wremap]  sys_wremap,
 [SYS_getwmapinfo] sys_getwmapinfo,
 [SYS_getpgdirinfo] sys_getpgdirinfo,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex]   sys_futex,
+[SYS_sysstat] sys_sysstat,
+[SYS_lockstat] sys_lockstat,
+[SYS_fsstat]  sys_fsstat,
+[SYS_sync]    sys_sync,
+[SYS_splice]  sys_splice,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_memstat] sys_memstat,
 };
 
+// Per-CPU, per-syscall accounting. Each CPU only touches its
+// own row, so recording needs no lock; calls are charged to the
+// CPU they finish on. exit() never returns and is not counted.
+// TSCs of different CPUs need not agree, so a call that moved
+// to another CPU while it slept is counted but not timed.
+struct sysacct {
+  uint count;
+  uint timed;
+  unsigned long long cycles;
+  unsigned long long maxcycles;
+};
+
+static struct sysacct sysacct[NCPU][NELEM(syscalls)];
+static int sysaccton;
+
+// Charge system call num, which began at time t0 on CPU c0.
+static void
+sysacctrecord(int num, int c0, unsigned long long t0)
+{
+  struct sysacct *a;
+  unsigned long long t1;
+
+  pushcli();
+  t1 = rdtsc();
+  a = &sysacct[cpuid()][num];
+  a->count++;
+  if(cpuid() == c0 && t1 >= t0){
+    a->timed++;
+    a->cycles += t1 - t0;
+    if(t1 - t0 > a->maxcycles)
+      a->maxcycles = t1 - t0;
+  }
+  popcli();
+}
+
+// Cycles in units of 1024, saturated to fit a uint.
+static uint
+kcycles(unsigned long long cycles)
+{
+  cycles >>= 10;
+  return cycles > 0xffffffff ? 0xffffffff : cycles;
+}
+
+// Control and report system call accounting.
+int
+sysstat(int cmd, struct sysstat *st)
+{
+  int c, i;
+  unsigned long long cycles, max;
+
+  switch(cmd){
+  case SYSSTAT_ENABLE:
+    sysaccton = 1;
+    return 0;
+  case SYSSTAT_DISABLE:
+    sysaccton = 0;
+    return 0;
+  case SYSSTAT_RESET:
+    memset(sysacct, 0, sizeof(sysacct));
+    return 0;
+  case SYSSTAT_GET:
+    memset(st, 0, sizeof(*st));
+    st->enabled = sysaccton;
+    for(i = 0; i < NELEM(syscalls) && i < MAX_SYSSTAT; i++){
+      cycles = max = 0;
+      for(c = 0; c < ncpu; c++){
+        st->count[i] += sysacct[c][i].count;
+        st->timed[i] += sysacct[c][i].timed;
+        cycles += sysacct[c][i].cycles;
+        if(sysacct[c][i].maxcycles > max)
+          max = sysacct[c][i].maxcycles;
+      }
+      st->kcycles[i] = kcycles(cycles);
+      st->maxkcycles[i] = kcycles(max);
+    }
+    return 0;
+  }
+  return -1;
+}
+
 void
 syscall(void)
 {
-  int num;
+  int num, c0;
+  unsigned long long t0;
   struct proc *curproc = myproc();
 
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    if(!sysaccton){
+      curproc->tf->eax = syscalls[num]();
+      return;
+    }
+    pushcli();
+    c0 = cpuid();
+    t0 = rdtsc();
+    popcli();
     curproc->tf->eax = syscalls[num]();
+    sysacctrecord(num, c0, t0);
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
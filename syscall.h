@@ -26,3 +26,16 @@
 #define SYS_getwmapinfo  25
 #define SYS_getpgdirinfo  26
 
+#define SYS_clone  27
+#define SYS_join   28
+#define SYS_futex  29
+#define SYS_sysstat 30
+#define SYS_lockstat 31
+#define SYS_fsstat 32
+#define SYS_sync   33
+#define SYS_splice 34
+#define SYS_readv  35
+#define SYS_writev 36
+#define SYS_pread  37
+#define SYS_pwrite 38
+#define SYS_memstat 39
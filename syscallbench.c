@@ -0,0 +1,84 @@
+// Compare system call latency through sysenter (the usys.S
+// default) with the int $T_SYSCALL path.
+//
+//   syscallbench [iterations]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+#define N 100000
+
+// Cycles per iteration.  We have no 64-bit division, so
+// divide the 64-bit total by n with divl, high word first;
+// a quotient too big for 32 bits saturates.
+static uint
+percall(unsigned long long t0, unsigned long long t1, int n)
+{
+  unsigned long long d;
+  uint hi, lo, q, r;
+
+  d = t1 - t0;
+  hi = d >> 32;
+  lo = d;
+  if(hi >= (uint)n)
+    return 0xffffffff;
+  r = hi;  // hi < n, so the quotient fits in 32 bits
+  asm volatile("divl %4" : "=a" (q), "=d" (r) : "a" (lo), "d" (r), "rm" ((uint)n));
+  return q;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, fds[2];
+  char c;
+  unsigned long long t0, t1;
+
+  n = N;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    printf(2, "usage: syscallbench [iterations]\n");
+    exit();
+  }
+
+  t0 = rdtsc();
+  for(i = 0; i < n; i++)
+    getpid();
+  t1 = rdtsc();
+  printf(1, "getpid sysenter: %d cycles/call\n", percall(t0, t1, n));
+
+  t0 = rdtsc();
+  for(i = 0; i < n; i++)
+    getpid_int();
+  t1 = rdtsc();
+  printf(1, "getpid int:      %d cycles/call\n", percall(t0, t1, n));
+
+  if(pipe(fds) < 0){
+    printf(2, "syscallbench: pipe failed\n");
+    exit();
+  }
+  c = 'x';
+
+  t0 = rdtsc();
+  for(i = 0; i < n; i++){
+    write(fds[1], &c, 1);
+    read(fds[0], &c, 1);
+  }
+  t1 = rdtsc();
+  printf(1, "pipe 1-byte write+read sysenter: %d cycles\n", percall(t0, t1, n));
+
+  t0 = rdtsc();
+  for(i = 0; i < n; i++){
+    write_int(fds[1], &c, 1);
+    read_int(fds[0], &c, 1);
+  }
+  t1 = rdtsc();
+  printf(1, "pipe 1-byte write+read int:      %d cycles\n", percall(t0, t1, n));
+
+  close(fds[0]);
+  close(fds[1]);
+  exit();
+}
@@ -13,12 +13,17 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "share.h"
 #include "file.h"
 #include "fcntl.h"
 #include "wmap.h"
+#include "fsstat.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
-// and return both the descriptor and the corresponding struct file.
+// and return both the descriptor and a new reference to the
+// corresponding struct file, which another thread closing the
+// descriptor cannot free.  The caller must fileclose() it.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
@@ -27,32 +32,56 @@ argfd(int n, int *pfd, struct file **pf)
 
   if (argint(n, &fd) < 0)
     return -1;
-  if (fd < 0 || fd >= NOFILE || (f = myproc()->ofile[fd]) == 0)
+  if ((f = ofileget(myproc()->sh, fd)) == 0)
     return -1;
   if (pfd)
     *pfd = fd;
-  if (pf)
-    *pf = f;
+  *pf = f;
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
+// Allocate the lowest free file descriptor for the given file,
+// growing the descriptor table if it is full.
 // Takes over file reference from caller on success.
 static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *curproc = myproc();
+  struct share *sh = myproc()->sh;
 
-  for (fd = 0; fd < NOFILE; fd++)
+  acquire(&sh->flock);
+  for (fd = sh->fdfree; fd < sh->nofile; fd++)
+    if (sh->ofile[fd] == 0)
+      goto found;
+  if (ofilegrow(sh) < 0)
   {
-    if (curproc->ofile[fd] == 0)
-    {
-      curproc->ofile[fd] = f;
-      return fd;
-    }
+    release(&sh->flock);
+    return -1;
   }
-  return -1;
+found:
+  sh->ofile[fd] = f;
+  sh->fdfree = fd + 1;
+  release(&sh->flock);
+  return fd;
+}
+
+// Free file descriptor fd and return its file, which the
+// caller closes, or 0 if fd is not open.
+static struct file *
+fdfree(int fd)
+{
+  struct share *sh = myproc()->sh;
+  struct file *f = 0;
+
+  acquire(&sh->flock);
+  if (fd >= 0 && fd < sh->nofile && (f = sh->ofile[fd]) != 0)
+  {
+    sh->ofile[fd] = 0;
+    if (fd < sh->fdfree)
+      sh->fdfree = fd;
+  }
+  release(&sh->flock);
+  return f;
 }
 
 int sys_dup(void)
@@ -63,31 +92,37 @@ int sys_dup(void)
   if (argfd(0, 0, &f) < 0)
     return -1;
   if ((fd = fdalloc(f)) < 0)
+  {
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
 int sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   char *p;
 
-  if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if (argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = fileread(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 int sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   char *p;
 
-  if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if (argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-  return filewrite(f, p, n);
+  r = filewrite(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 int sys_close(void)
@@ -95,9 +130,8 @@ int sys_close(void)
   int fd;
   struct file *f;
 
-  if (argfd(0, &fd, &f) < 0)
+  if (argint(0, &fd) < 0 || (f = fdfree(fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -106,10 +140,13 @@ int sys_fstat(void)
 {
   struct file *f;
   struct stat *st;
+  int r;
 
-  if (argfd(0, 0, &f) < 0 || argptr(1, (void *)&st, sizeof(*st)) < 0)
+  if (argptr(1, (void *)&st, sizeof(*st)) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, st);
+  fileclose(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -165,17 +202,18 @@ bad:
 }
 
 // Is the directory dp empty except for "." and ".." ?
+// (In a hashed directory they need not be the first entries.)
 static int
 isdirempty(struct inode *dp)
 {
   int off;
   struct dirent de;
 
-  for (off = 2 * sizeof(de); off < dp->size; off += sizeof(de))
+  for (off = 0; off < dp->size; off += sizeof(de))
   {
     if (readi(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
-    if (de.inum != 0)
+    if (de.inum != 0 && namecmp(de.name, ".") != 0 && namecmp(de.name, "..") != 0)
       return 0;
   }
   return 1;
@@ -185,7 +223,6 @@ isdirempty(struct inode *dp)
 int sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], *path;
   uint off;
 
@@ -217,9 +254,7 @@ int sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if (writei(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if (ip->type == T_DIR)
   {
     dp->nlink--;
@@ -272,6 +307,7 @@ create(char *path, short type, short major, short minor)
 
   if (type == T_DIR)
   {              // Create . and .. entries.
+    dirinit(ip);
     dp->nlink++; // for ".."
     iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
@@ -447,7 +483,7 @@ int sys_pipe(void)
   if ((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0)
   {
     if (fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
+      fdfree(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -467,7 +503,10 @@ uint sys_wmap(void)
   if (argint(0, (int *)&addr) < 0 || argint(1, &length) < 0 || argint(2, &flags) < 0 || argint(3, &fd) < 0)
     return -1;
 
-  return wmap(addr, length, flags, fd);
+  acquiresleep(&myproc()->sh->lock);
+  addr = wmap(addr, length, flags, fd);
+  releasesleep(&myproc()->sh->lock);
+  return addr;
 }
 
 // memory unmap system call
@@ -479,8 +518,14 @@ int sys_wunmap(void)
   if (argint(0, (int *)&addr) < 0 || argint(1, &length) < 0)
     return -1;
 
-  
-  return wunmap(addr);
+  acquiresleep(&myproc()->sh->lock);
+  if (wunmap(addr) < 0)
+  {
+    releasesleep(&myproc()->sh->lock);
+    return -1;
+  }
+  releasesleep(&myproc()->sh->lock);
+  return 0;
 }
 
 int sys_wremap(void)
@@ -491,15 +536,23 @@ int sys_wremap(void)
   if (argint(0, (int *)&old_addr) < 0 || argint(1, &old_length) < 0 || argint(2, &new_length) < 0 || argint(3, &flags) < 0 || argint(4, &fd) < 0)
     return -1;
 
-  return wremap(old_addr, old_length, new_length, flags);
+  acquiresleep(&myproc()->sh->lock);
+  old_addr = wremap(old_addr, old_length, new_length, flags);
+  releasesleep(&myproc()->sh->lock);
+  return old_addr;
 }
 
 int sys_getwmapinfo(void)
 {
   struct wmapinfo *wminfo;
+  int r;
+
   if (argptr(0, (void *)&wminfo, sizeof(*wminfo)) < 0)
     return -1;
-  return getwmapinfo(wminfo);
+  acquiresleep(&myproc()->sh->lock);
+  r = getwmapinfo(wminfo);
+  releasesleep(&myproc()->sh->lock);
+  return r;
 }
 
 int sys_getpgdirinfo(void)
@@ -509,3 +562,119 @@ int sys_getpgdirinfo(void)
     return -1;
   return getpgdirinfo(pdinfo);
 }
+
+int sys_fsstat(void)
+{
+  int cmd;
+  struct fsstat *st;
+
+  st = 0;
+  if (argint(0, &cmd) < 0)
+    return -1;
+  if (cmd == FSSTAT_GET && argptr(1, (void *)&st, sizeof(*st)) < 0)
+    return -1;
+  return fsstat(cmd, st);
+}
+
+// Commit all finished file system calls to disk.
+int sys_sync(void)
+{
+  logflush();
+  return 0;
+}
+
+// Move bytes between two descriptors inside the kernel.
+int sys_splice(void)
+{
+  struct file *in, *out;
+  int n, r;
+
+  if (argint(2, &n) < 0 || n < 0 || argfd(0, 0, &in) < 0)
+    return -1;
+  if (argfd(1, 0, &out) < 0)
+  {
+    fileclose(in);
+    return -1;
+  }
+  r = filesplice(in, out, n);
+  fileclose(in);
+  fileclose(out);
+  return r;
+}
+
+// Fetch the iovec array at argument n with cnt entries into
+// iov, checking that every buffer lies in user memory.  The
+// array is copied so another thread cannot change it after
+// the check.
+static int
+argiov(int n, int cnt, struct iovec *iov)
+{
+  struct proc *curproc = myproc();
+  char *p;
+  int i;
+
+  if (cnt < 0 || cnt > IOV_MAX || argptr(n, &p, cnt * sizeof(*iov)) < 0)
+    return -1;
+  memmove(iov, p, cnt * sizeof(*iov));
+  for (i = 0; i < cnt; i++)
+  {
+    if ((int)iov[i].len < 0 || (uint)iov[i].base >= curproc->sh->sz ||
+        (uint)iov[i].base + iov[i].len > curproc->sh->sz)
+      return -1;
+    if (prefault(curproc, (uint)iov[i].base, iov[i].len) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+int sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt, r;
+
+  if (argint(2, &cnt) < 0 || argiov(1, cnt, iov) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filereadv(f, iov, cnt);
+  fileclose(f);
+  return r;
+}
+
+int sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt, r;
+
+  if (argint(2, &cnt) < 0 || argiov(1, cnt, iov) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filewritev(f, iov, cnt);
+  fileclose(f);
+  return r;
+}
+
+int sys_pread(void)
+{
+  struct file *f;
+  int n, off, r;
+  char *p;
+
+  if (argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argint(3, &off) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filepread(f, p, n, off);
+  fileclose(f);
+  return r;
+}
+
+int sys_pwrite(void)
+{
+  struct file *f;
+  int n, off, r;
+  char *p;
+
+  if (argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argint(3, &off) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filepwrite(f, p, n, off);
+  fileclose(f);
+  return r;
+}
@@ -6,6 +6,9 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "sysstat.h"
+#include "memstat.h"
+#include "lockstat.h"
 
 int
 sys_fork(void)
@@ -26,6 +29,29 @@ sys_wait(void)
   return wait();
 }
 
+int
+sys_clone(void)
+{
+  int fcn, arg1, arg2;
+  char *stack;
+
+  if(argint(0, &fcn) < 0 || argint(1, &arg1) < 0 || argint(2, &arg2) < 0)
+    return -1;
+  if(argptr(3, &stack, PGSIZE) < 0)
+    return -1;
+  return clone((void(*)(void*, void*))fcn, (void*)arg1, (void*)arg2, stack);
+}
+
+int
+sys_join(void)
+{
+  void **stack;
+
+  if(argptr(0, (void*)&stack, sizeof(*stack)) < 0)
+    return -1;
+  return join(stack);
+}
+
 int
 sys_kill(void)
 {
@@ -36,6 +62,44 @@ sys_kill(void)
   return kill(pid);
 }
 
+int
+sys_futex(void)
+{
+  int addr, op, val;
+
+  if(argint(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  return futex((uint)addr, op, val);
+}
+
+int
+sys_sysstat(void)
+{
+  int cmd;
+  struct sysstat *st;
+
+  st = 0;
+  if(argint(0, &cmd) < 0)
+    return -1;
+  if(cmd == SYSSTAT_GET && argptr(1, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  return sysstat(cmd, st);
+}
+
+int
+sys_lockstat(void)
+{
+  int cmd;
+  struct lockstat *st;
+
+  st = 0;
+  if(argint(0, &cmd) < 0)
+    return -1;
+  if(cmd == LOCKSTAT_GET && argptr(1, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  return lockstat(cmd, st);
+}
+
 int
 sys_getpid(void)
 {
@@ -50,8 +114,7 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if((addr = growproc(n)) < 0)
     return -1;
   return addr;
 }
@@ -89,3 +152,18 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+int
+sys_memstat(void)
+{
+  struct memstat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  st->free_pages = kfreepages();
+  textstat(st);
+  heapstat(myproc(), st);
+  tlbstat(st);
+  kmem_cache_stat(st);
+  return 0;
+}
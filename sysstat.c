@@ -0,0 +1,120 @@
+// Report per-system-call counts and cycle totals.
+//
+//   sysstat on|off|reset
+//   sysstat [n]           print the n most expensive calls (default 10)
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "syscall.h"
+#include "sysstat.h"
+
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+static char *names[] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_wmap]    "wmap",
+[SYS_wunmap]  "wunmap",
+[SYS_wremap]  "wremap",
+[SYS_getwmapinfo] "getwmapinfo",
+[SYS_getpgdirinfo] "getpgdirinfo",
+[SYS_clone]   "clone",
+[SYS_join]    "join",
+[SYS_futex]   "futex",
+[SYS_sysstat] "sysstat",
+[SYS_lockstat] "lockstat",
+[SYS_fsstat]  "fsstat",
+[SYS_sync]    "sync",
+[SYS_splice]  "splice",
+[SYS_readv]   "readv",
+[SYS_writev]  "writev",
+[SYS_pread]   "pread",
+[SYS_pwrite]  "pwrite",
+[SYS_memstat] "memstat",
+};
+
+struct sysstat st;
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, n, t, order[MAX_SYSSTAT];
+  uint avg;
+  char *name;
+
+  if(argc > 1 && strcmp(argv[1], "on") == 0){
+    sysstat(SYSSTAT_ENABLE, 0);
+    exit();
+  }
+  if(argc > 1 && strcmp(argv[1], "off") == 0){
+    sysstat(SYSSTAT_DISABLE, 0);
+    exit();
+  }
+  if(argc > 1 && strcmp(argv[1], "reset") == 0){
+    sysstat(SYSSTAT_RESET, 0);
+    exit();
+  }
+
+  n = 10;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(sysstat(SYSSTAT_GET, &st) < 0){
+    printf(2, "sysstat: failed\n");
+    exit();
+  }
+  if(!st.enabled)
+    printf(1, "(accounting is off; run \"sysstat on\")\n");
+
+  // Sort by total cycles, largest first.
+  for(i = 0; i < MAX_SYSSTAT; i++)
+    order[i] = i;
+  for(i = 1; i < MAX_SYSSTAT; i++){
+    for(j = i; j > 0 && st.kcycles[order[j]] > st.kcycles[order[j-1]]; j--){
+      t = order[j];
+      order[j] = order[j-1];
+      order[j-1] = t;
+    }
+  }
+
+  printf(1, "syscall          calls    kcycles    avg cycles    max kcycles\n");
+  for(i = 0; i < MAX_SYSSTAT && i < n; i++){
+    t = order[i];
+    if(st.count[t] == 0)
+      break;
+    name = "?";
+    if(t < NELEM(names) && names[t])
+      name = names[t];
+    printf(1, "%s", name);
+    for(j = strlen(name); j < 16; j++)
+      printf(1, " ");
+    if(st.timed[t] == 0)
+      avg = 0;
+    else if(st.kcycles[t] < 0x400000)
+      avg = st.kcycles[t] * 1024 / st.timed[t];
+    else
+      avg = st.kcycles[t] / st.timed[t] * 1024;
+    printf(1, "%d    %d    %d    %d\n", st.count[t], st.kcycles[t],
+           avg, st.maxkcycles[t]);
+  }
+  exit();
+}
@@ -0,0 +1,14 @@
+// for `sysstat`
+#define SYSSTAT_GET     0  // fill in struct sysstat
+#define SYSSTAT_ENABLE  1  // start counting
+#define SYSSTAT_DISABLE 2  // stop counting
+#define SYSSTAT_RESET   3  // zero all counters
+
+#define MAX_SYSSTAT 64     // syscall numbers reported, must exceed the largest SYS_*
+struct sysstat {
+  int enabled;                 // is accounting on?
+  uint count[MAX_SYSSTAT];     // completed calls, summed over CPUs
+  uint timed[MAX_SYSSTAT];     // of those, calls that ended on the CPU they began on
+  uint kcycles[MAX_SYSSTAT];   // total cycles of timed calls / 1024
+  uint maxkcycles[MAX_SYSSTAT]; // longest single timed call, in cycles / 1024
+};
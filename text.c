@@ -0,0 +1,166 @@
+// Shared program text.
+//
+// exec() leaves a program's pages to be read in as they are
+// touched (see pagein() in vm.c).  Pages of read-only segments
+// are kept here, keyed by inode and address, so that every
+// process running the same program maps the same physical
+// pages.  A page stays cached while its inode is in use; it is
+// dropped when the last reference to the inode goes away or
+// when the file is written, though processes already mapping
+// it keep their copy until they unmap it.
+//
+// Shared pages are mapped without PTE_W and with PTE_TEXT.  A
+// write to one gives the writer a private copy (unsharetext()
+// in vm.c).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "memstat.h"
+
+struct textpg {
+  uint dev;      // inode the page came from; 0 once invalidated
+  uint inum;
+  uint va;       // where the page sits in the program
+  char *mem;     // the page; 0 if this slot is free
+  int ref;       // page table entries mapping it
+};
+
+struct {
+  struct spinlock lock;
+  struct textpg pg[NTEXTPG];
+} textcache;
+
+void
+textinit(void)
+{
+  initlock(&textcache.lock, "textcache");
+}
+
+// Return the cached page at va in ip's program, with a new
+// reference for the caller, or 0 if it is not cached.
+// Caller holds ip->lock.
+char*
+textget(struct inode *ip, uint va)
+{
+  struct textpg *t;
+  char *mem;
+
+  mem = 0;
+  acquire(&textcache.lock);
+  for(t = textcache.pg; t < &textcache.pg[NTEXTPG]; t++){
+    if(t->mem && t->dev == ip->dev && t->inum == ip->inum && t->va == va){
+      t->ref++;
+      mem = t->mem;
+      break;
+    }
+  }
+  release(&textcache.lock);
+  return mem;
+}
+
+// Cache mem as the page at va in ip's program, with one
+// reference for the caller.  Returns -1 if the cache is full.
+// Caller holds ip->lock, so no one else can be adding it.
+int
+textadd(struct inode *ip, uint va, char *mem)
+{
+  struct textpg *t;
+
+  acquire(&textcache.lock);
+  for(t = textcache.pg; t < &textcache.pg[NTEXTPG]; t++){
+    if(t->mem == 0){
+      t->dev = ip->dev;
+      t->inum = ip->inum;
+      t->va = va;
+      t->mem = mem;
+      t->ref = 1;
+      ip->text = 1;
+      release(&textcache.lock);
+      return 0;
+    }
+  }
+  release(&textcache.lock);
+  return -1;
+}
+
+static struct textpg*
+textfind(char *mem)
+{
+  struct textpg *t;
+
+  for(t = textcache.pg; t < &textcache.pg[NTEXTPG]; t++)
+    if(t->mem == mem)
+      return t;
+  panic("textfind");
+}
+
+// Take another reference to the cached page mem.
+void
+textdup(char *mem)
+{
+  acquire(&textcache.lock);
+  textfind(mem)->ref++;
+  release(&textcache.lock);
+}
+
+// Drop a reference to the cached page mem, freeing it if it
+// was invalidated and this was the last one.
+void
+textput(char *mem)
+{
+  struct textpg *t;
+
+  acquire(&textcache.lock);
+  t = textfind(mem);
+  if(--t->ref == 0 && t->dev == 0){
+    kfree(t->mem);
+    t->mem = 0;
+  }
+  release(&textcache.lock);
+}
+
+// Forget ip's cached pages: free those no one maps, and leave
+// the rest to their current users.  Caller holds ip->lock.
+void
+textinval(struct inode *ip)
+{
+  struct textpg *t;
+
+  acquire(&textcache.lock);
+  for(t = textcache.pg; t < &textcache.pg[NTEXTPG]; t++){
+    if(t->mem == 0 || t->dev != ip->dev || t->inum != ip->inum)
+      continue;
+    t->dev = 0;
+    if(t->ref == 0){
+      kfree(t->mem);
+      t->mem = 0;
+    }
+  }
+  ip->text = 0;
+  release(&textcache.lock);
+}
+
+void
+textstat(struct memstat *st)
+{
+  struct textpg *t;
+
+  st->text_cached = st->text_inuse = st->text_maps = 0;
+  acquire(&textcache.lock);
+  for(t = textcache.pg; t < &textcache.pg[NTEXTPG]; t++){
+    if(t->mem == 0)
+      continue;
+    if(t->dev != 0)
+      st->text_cached++;
+    if(t->ref > 0)
+      st->text_inuse++;
+    st->text_maps += t->ref;
+  }
+  release(&textcache.lock);
+}
@@ -10,6 +10,7 @@
 #include "wmap.h"
 #include "fs.h"
 #include "sleeplock.h"
+#include "share.h"
 #include "file.h"
 #include "stat.h"
 #include "fcntl.h"
@@ -38,6 +39,18 @@ void idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// Fast system call entry from sysenter_entry in trapasm.S,
+// with tf built to match an int $T_SYSCALL frame.
+void sysenter(struct trapframe *tf)
+{
+  if (myproc()->killed)
+    exit();
+  myproc()->tf = tf;
+  syscall();
+  if (myproc()->killed)
+    exit();
+}
+
 // PAGEBREAK: 41
 void trap(struct trapframe *tf)
 {
@@ -52,6 +65,16 @@ void trap(struct trapframe *tf)
     return;
   }
 
+  // sysenter on a CPU without SEP: emulate it with the int path,
+  // returning to the address the stub left in %edx.
+  if (tf->trapno == T_ILLOP && (tf->cs & 3) == DPL_USER &&
+      tf->eip + 2 <= myproc()->sh->sz && *(ushort *)tf->eip == 0x340f)
+  {
+    tf->eip = tf->edx;
+    sysenter(tf);
+    return;
+  }
+
   switch (tf->trapno)
   {
   case T_PGFLT:
@@ -60,9 +83,18 @@ void trap(struct trapframe *tf)
     struct proc *curproc = myproc();
     struct wmap_region *wmap_region;
     int i;
-    for (i = 0; i < 16; i++)
+
+    // Program image and heap pages are filled in on first touch,
+    // and a write to shared text gets a private copy.
+    if ((tf->err & FEC_PR) == 0 && pagein(curproc, faulting_address) == 0)
+      return;
+    if ((tf->err & (FEC_PR | FEC_WR)) == (FEC_PR | FEC_WR) &&
+        unsharetext(curproc, faulting_address) == 0)
+      return;
+
+    for (i = 0; curproc->sh && i < 16; i++)
     {
-      wmap_region = curproc->wmap_regions[i];
+      wmap_region = curproc->sh->wmap_regions[i];
       if (wmap_region != 0 &&
           faulting_address >= wmap_region->addr &&
           faulting_address < wmap_region->addr + wmap_region->length)
@@ -80,8 +112,7 @@ void trap(struct trapframe *tf)
           if (mem == 0)
           {
             cprintf("out of memory\n");
-            kill(curproc->pid);
-            return;
+            goto bad;
           }
           memset(mem, 0, PGSIZE);
 
@@ -89,12 +120,14 @@ void trap(struct trapframe *tf)
           if (!(wmap_region->flags & MAP_ANONYMOUS))
           {
             // Check the file descriptor
-            struct file *f = curproc->ofile[wmap_region->fd];
+            struct file *f = ofileget(curproc->sh, wmap_region->fd);
             if (f == 0 || !(f->readable))
             {
               cprintf("invalid file descriptor\n");
-              kill(curproc->pid);
-              return;
+              if (f)
+                fileclose(f);
+              kfree(mem);
+              goto bad;
             }
 
             // Calculate the offset in the file
@@ -104,8 +137,9 @@ void trap(struct trapframe *tf)
             if (offset >= f->ip->size)
             {
               cprintf("invalid offset\n");
-              kill(curproc->pid);
-              return;
+              fileclose(f);
+              kfree(mem);
+              goto bad;
             }
 
             // Calculate the number of bytes to read
@@ -116,13 +150,14 @@ void trap(struct trapframe *tf)
             ilock(f->ip);
             int bytesRead = readi(f->ip, mem, offset, n);
             iunlock(f->ip);
+            fileclose(f);
 
             // Check the number of bytes read
             if (bytesRead != n)
             {
               cprintf("failed to read data from file\n");
-              kill(curproc->pid);
-              return;
+              kfree(mem);
+              goto bad;
             }
           }
 
@@ -130,14 +165,22 @@ void trap(struct trapframe *tf)
           {
             cprintf("out of memory (2)\n");
             kfree(mem); // Free the allocated page
-            kill(curproc->pid);
-            return;
+            goto bad;
           }
           break;
         }
         return;
       }
     }
+  bad:
+    // The kernel touches only user pages that prefault() or the
+    // like made present, so a fault it takes here would recur.
+    if ((tf->cs & 3) == 0)
+    {
+      cprintf("pid %d %s: kernel fault at eip 0x%x addr 0x%x\n",
+              curproc->pid, curproc->name, tf->eip, rcr2());
+      panic("trap: unresolved kernel page fault");
+    }
     // If the faulting address is not within a file-backed memory mapping, segfault
     cprintf("pid %d %s: trap %d err %d on cpu %d "
             "eip 0x%x addr 0x%x--kill proc\n",
@@ -171,6 +214,10 @@ void trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_TLBFLUSH:
+    tlbpoll();
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
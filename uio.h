@@ -0,0 +1,7 @@
+// for `readv` and `writev`
+#define IOV_MAX 16  // most iovecs one call will take
+
+struct iovec {
+  void *base;  // start of buffer
+  uint len;    // bytes in buffer
+};
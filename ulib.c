@@ -3,6 +3,9 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "param.h"
+#include "mmu.h"
+#include "futex.h"
 
 char*
 strcpy(char *s, const char *t)
@@ -104,3 +107,121 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Start a thread running start_routine(arg1, arg2) on a fresh
+// page-aligned stack. The malloc'd block is remembered in the
+// word just below the stack so thread_join can free it.
+int
+thread_create(void (*start_routine)(void*, void*), void *arg1, void *arg2)
+{
+  char *mem, *stack;
+  int pid;
+
+  if((mem = malloc(2*PGSIZE + sizeof(char*))) == 0)
+    return -1;
+  stack = (char*)PGROUNDUP((uint)mem + sizeof(char*));
+  ((char**)stack)[-1] = mem;
+  if((pid = clone(start_routine, arg1, arg2, stack)) < 0)
+    free(mem);
+  return pid;
+}
+
+// Wait for a child thread to exit and free its stack.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) < 0)
+    return -1;
+  free(((char**)stack)[-1]);
+  return pid;
+}
+
+void
+lock_init(lock_t *lk)
+{
+  lk->locked = 0;
+}
+
+void
+lock_acquire(lock_t *lk)
+{
+  while(xchg(&lk->locked, 1) != 0)
+    ;
+  __sync_synchronize();
+}
+
+void
+lock_release(lock_t *lk)
+{
+  __sync_synchronize();
+  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+}
+
+// Mutexes only enter the kernel when contended: state 1 means
+// locked, 2 means locked and somebody may be sleeping in futex.
+void
+mutex_init(mutex_t *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(mutex_t *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = xchg((volatile uint*)&m->state, 2);
+  while(c != 0){
+    futex((void*)&m->state, FUTEX_WAIT, 2);
+    c = xchg((volatile uint*)&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(mutex_t *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    m->state = 0;
+    futex((void*)&m->state, FUTEX_WAKE, 1);
+  }
+}
+
+void
+cond_init(cond_t *c)
+{
+  c->seq = 0;
+}
+
+// Atomically release m and wait for a signal on c.
+// As with any condition variable, callers must recheck
+// their predicate after waking.
+void
+cond_wait(cond_t *c, mutex_t *m)
+{
+  int seq;
+
+  seq = c->seq;
+  mutex_unlock(m);
+  futex((void*)&c->seq, FUTEX_WAIT, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(cond_t *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex((void*)&c->seq, FUTEX_WAKE, 1);
+}
+
+void
+cond_broadcast(cond_t *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex((void*)&c->seq, FUTEX_WAKE, NPROC);
+}
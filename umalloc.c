@@ -2,9 +2,24 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "mmu.h"
+#include "wmap.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator.
+//
+// Small requests, up to MAXSMALL bytes, are rounded up to a
+// power-of-two size class and served from that class's free
+// list, which is refilled from a slab of SLABSIZE bytes taken
+// from sbrk() a block at a time, so malloc and free of small
+// blocks take constant time.  Requests of LARGE bytes and more
+// get an anonymous wmap() region of their own, handed back to
+// the kernel by free().  Everything else, and large requests
+// when wmap() fails, comes from the first-fit free list of
+// Kernighan and Ritchie, The C Programming Language, 2nd ed.
+// Section 8.7.
+//
+// Every block starts with a Header.  While a block is in use
+// its ptr field says which of the three it came from.
 
 typedef long Align;
 
@@ -18,15 +33,28 @@ union header {
 
 typedef union header Header;
 
+#define INLIST  ((Header*)0)  // from the K&R list; size in Headers
+#define INCLASS ((Header*)1)  // from a size class; size is the class
+#define INWMAP  ((Header*)2)  // a wmap region; size in bytes
+
+#define MINSMALL  16          // payload of the smallest class
+#define NCLASS    8           // classes hold MINSMALL << 0..NCLASS-1
+#define MAXSMALL  (MINSMALL << (NCLASS-1))
+#define SLABSIZE  (4*PGSIZE)
+#define LARGE     (16*PGSIZE)
+
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+static Header *classfree[NCLASS];   // freed blocks of each class
+static char *slabnext[NCLASS];      // uncarved part of each slab
+static char *slabend[NCLASS];
+
+static void
+listfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -43,6 +71,23 @@ free(void *ap)
   freep = p;
 }
 
+void
+free(void *ap)
+{
+  Header *bp;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  if(bp->s.ptr == INCLASS){
+    bp->s.ptr = classfree[bp->s.size];
+    classfree[bp->s.size] = bp;
+  } else if(bp->s.ptr == INWMAP)
+    wunmap((uint)bp);
+  else
+    listfree(bp);
+}
+
 static Header*
 morecore(uint nu)
 {
@@ -56,12 +101,12 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  listfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+static void*
+listalloc(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
@@ -81,6 +126,7 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
+      p->s.ptr = INLIST;
       return (void*)(p + 1);
     }
     if(p == freep)
@@ -88,3 +134,60 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+static void*
+classalloc(int c)
+{
+  Header *p;
+  uint n;
+
+  if((p = classfree[c]) != 0)
+    classfree[c] = p->s.ptr;
+  else {
+    n = sizeof(Header) + (MINSMALL << c);
+    if(slabnext[c] + n > slabend[c]){
+      if((slabnext[c] = sbrk(SLABSIZE)) == (char*)-1){
+        slabnext[c] = slabend[c] = 0;
+        return 0;
+      }
+      slabend[c] = slabnext[c] + SLABSIZE;
+    }
+    p = (Header*)slabnext[c];
+    slabnext[c] += n;
+  }
+  p->s.ptr = INCLASS;
+  p->s.size = c;
+  return (void*)(p + 1);
+}
+
+static void*
+wmapalloc(uint nbytes)
+{
+  Header *p;
+  uint n;
+
+  n = PGROUNDUP(nbytes + sizeof(Header));
+  p = (Header*)wmap(0, n, MAP_ANONYMOUS | MAP_PRIVATE, -1);
+  if(p == (Header*)FAILED)
+    return 0;
+  p->s.ptr = INWMAP;
+  p->s.size = n;
+  return (void*)(p + 1);
+}
+
+void*
+malloc(uint nbytes)
+{
+  void *p;
+  int c;
+
+  if(nbytes <= MAXSMALL){
+    for(c = 0; (MINSMALL << c) < nbytes; c++)
+      ;
+    if((p = classalloc(c)) != 0)
+      return p;
+  } else if(nbytes >= LARGE && nbytes < 0x7fffffff - PGSIZE &&
+            (p = wmapalloc(nbytes)) != 0)
+    return p;
+  return listalloc(nbytes);
+}
@@ -2,6 +2,11 @@ struct stat;
 struct rtcdate;
 struct wmapinfo;
 struct pgdirinfo;
+struct sysstat;
+struct lockstat;
+struct fsstat;
+struct memstat;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -30,6 +35,22 @@ int wunmap(uint addr);
 uint wremap(uint oldaddr, int oldsize, int newsize, int flags);
 int getwmapinfo(struct wmapinfo *wmi);
 int getpgdirinfo(struct pgdirinfo *pgdi);
+int clone(void(*)(void*, void*), void*, void*, void*);
+int join(void**);
+int futex(void*, int, int);
+int getpid_int(void);
+int read_int(int, void*, int);
+int write_int(int, const void*, int);
+int sysstat(int, struct sysstat*);
+int lockstat(int, struct lockstat*);
+int fsstat(int, struct fsstat*);
+int sync(void);
+int splice(int, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, uint);
+int pwrite(int, const void*, int, uint);
+int memstat(struct memstat*);
 
 
 // ulib.c
@@ -45,3 +66,31 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+
+// user-level threads (ulib.c)
+typedef struct {
+  volatile uint locked;
+} lock_t;
+
+int thread_create(void(*)(void*, void*), void*, void*);
+int thread_join(void);
+void lock_init(lock_t*);
+void lock_acquire(lock_t*);
+void lock_release(lock_t*);
+
+// futex-based mutex and condition variable (ulib.c)
+typedef struct {
+  volatile int state;  // 0 unlocked, 1 locked, 2 locked with waiters
+} mutex_t;
+
+typedef struct {
+  volatile int seq;
+} cond_t;
+
+void mutex_init(mutex_t*);
+void mutex_lock(mutex_t*);
+void mutex_unlock(mutex_t*);
+void cond_init(cond_t*);
+void cond_wait(cond_t*, mutex_t*);
+void cond_signal(cond_t*);
+void cond_broadcast(cond_t*);
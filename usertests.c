@@ -7,6 +7,12 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "mmu.h"
+#include "futex.h"
+#include "fsstat.h"
+#include "uio.h"
+#include "memstat.h"
+#include "wmap.h"
 
 char buf[8192];
 char name[3];
@@ -184,6 +190,51 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// two files written a block at a time in turn: each should
+// get its own runs of blocks rather than interleaving.
+// (Directories, whose bucket blocks are allocated in no
+// particular order, exercise the double-indirect tree.)
+void
+extenttest(void)
+{
+  int i, j, fd[2];
+  char *names[] = { "ext0", "ext1" };
+
+  printf(stdout, "extent test\n");
+  for(j = 0; j < 2; j++){
+    if((fd[j] = open(names[j], O_CREATE|O_RDWR)) < 0){
+      printf(stdout, "extent test create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < 100; i++){
+    for(j = 0; j < 2; j++){
+      ((int*)buf)[0] = i;
+      ((int*)buf)[1] = j;
+      if(write(fd[j], buf, BSIZE) != BSIZE){
+        printf(stdout, "extent test write failed\n");
+        exit();
+      }
+    }
+  }
+  for(j = 0; j < 2; j++){
+    close(fd[j]);
+    fd[j] = open(names[j], 0);
+    for(i = 0; i < 100; i++){
+      if(read(fd[j], buf, BSIZE) != BSIZE ||
+         ((int*)buf)[0] != i || ((int*)buf)[1] != j){
+        printf(stdout, "extent test: %s block %d wrong\n", names[j], i);
+        exit();
+      }
+    }
+    close(fd[j]);
+    unlink(names[j]);
+  }
+  printf(stdout, "extent test ok\n");
+}
+
+#define NBIG 300  // 512-byte writes in writetest1
+
 void
 writetest1(void)
 {
@@ -197,7 +248,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +268,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -300,6 +351,821 @@ exectest(void)
   }
 }
 
+// large pipe transfers, including whole pages that the
+// kernel hands over by remapping rather than copying.
+void
+pipepages(void)
+{
+  int fds[2], pid, i, j;
+  char *pg;
+
+  printf(stdout, "pipepages test\n");
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < 16; i++){
+      memset(buf, 'a' + i, PGSIZE);
+      if(write(fds[1], buf, PGSIZE) != PGSIZE){
+        printf(stdout, "pipepages write failed\n");
+        exit();
+      }
+    }
+    exit();
+  } else if(pid < 0){
+    printf(stdout, "fork() failed\n");
+    exit();
+  }
+  close(fds[1]);
+
+  // a page-aligned page of our own to read into
+  pg = sbrk(2*PGSIZE);
+  pg = (char*)(((uint)pg + PGSIZE - 1) & ~(PGSIZE - 1));
+  for(i = 0; i < 16; i++){
+    for(j = 0; j < PGSIZE; j += read(fds[0], pg + j, PGSIZE - j))
+      ;
+    for(j = 0; j < PGSIZE; j++){
+      if(pg[j] != 'a' + i){
+        printf(stdout, "pipepages: page %d byte %d wrong\n", i, j);
+        exit();
+      }
+    }
+  }
+  if(read(fds[0], pg, 1) != 0){
+    printf(stdout, "pipepages: extra data\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+  sbrk(-2*PGSIZE);
+  printf(stdout, "pipepages ok\n");
+}
+
+// splice a file into a pipe and into another file
+void
+splicetest(void)
+{
+  int fd, fd2, fds[2], pid, i, n, tot;
+
+  printf(stdout, "splice test\n");
+  unlink("splice0");
+  unlink("splice1");
+  fd = open("splice0", O_CREATE|O_RDWR);
+  for(i = 0; i < 5; i++){
+    memset(buf, 'a' + i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(stdout, "splice: write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  // file -> file
+  fd = open("splice0", O_RDONLY);
+  fd2 = open("splice1", O_CREATE|O_RDWR);
+  if(splice(fd, fd2, 5*sizeof(buf) + 100) != 5*sizeof(buf)){
+    printf(stdout, "splice: file to file short\n");
+    exit();
+  }
+  if(splice(fd, fd2, 100) != 0){
+    printf(stdout, "splice: no eof\n");
+    exit();
+  }
+  close(fd);
+  close(fd2);
+
+  // file -> pipe
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("splice1", O_RDONLY);
+    while(splice(fd, fds[1], 5*sizeof(buf)) > 0)
+      ;
+    exit();
+  } else if(pid < 0){
+    printf(stdout, "fork() failed\n");
+    exit();
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], buf, 1000)) > 0){
+    for(i = 0; i < n; i++){
+      if(buf[i] != 'a' + (tot + i) / sizeof(buf)){
+        printf(stdout, "splice: byte %d wrong\n", tot + i);
+        exit();
+      }
+    }
+    tot += n;
+  }
+  if(tot != 5*sizeof(buf)){
+    printf(stdout, "splice: got %d bytes\n", tot);
+    exit();
+  }
+  close(fds[0]);
+  wait();
+
+  if(splice(fds[0], 1, 1) != -1){
+    printf(stdout, "splice: closed fd ok\n");
+    exit();
+  }
+  unlink("splice0");
+  unlink("splice1");
+  printf(stdout, "splice ok\n");
+}
+
+// gather writes and scatter reads through a file and a pipe
+void
+iovtest(void)
+{
+  struct iovec iov[3];
+  char a[10], b[3000], c[5000];
+  int fd, fds[2], i;
+
+  printf(stdout, "iov test\n");
+  memset(a, 'a', sizeof(a));
+  memset(b, 'b', sizeof(b));
+  memset(c, 'c', sizeof(c));
+  iov[0].base = a;
+  iov[0].len = sizeof(a);
+  iov[1].base = b;
+  iov[1].len = sizeof(b);
+  iov[2].base = c;
+  iov[2].len = sizeof(c);
+
+  unlink("iovfile");
+  fd = open("iovfile", O_CREATE|O_RDWR);
+  if(writev(fd, iov, 3) != sizeof(a) + sizeof(b) + sizeof(c)){
+    printf(stdout, "writev failed\n");
+    exit();
+  }
+  close(fd);
+
+  // read back with the pieces in a different order
+  memset(buf, 0, sizeof(buf));
+  iov[0].base = buf;
+  iov[0].len = 5;
+  iov[1].base = buf + 5;
+  iov[1].len = sizeof(buf) - 5;
+  fd = open("iovfile", O_RDONLY);
+  if(readv(fd, iov, 2) != sizeof(a) + sizeof(b) + sizeof(c)){
+    printf(stdout, "readv failed\n");
+    exit();
+  }
+  close(fd);
+  for(i = 0; i < sizeof(a) + sizeof(b) + sizeof(c); i++){
+    if(buf[i] != (i < sizeof(a) ? 'a' : i < sizeof(a) + sizeof(b) ? 'b' : 'c')){
+      printf(stdout, "readv: byte %d wrong\n", i);
+      exit();
+    }
+  }
+  unlink("iovfile");
+
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  iov[0].base = a;
+  iov[0].len = 4;
+  iov[1].base = b;
+  iov[1].len = 4;
+  if(writev(fds[1], iov, 2) != 8){
+    printf(stdout, "writev pipe failed\n");
+    exit();
+  }
+  // a pipe readv returns what is there rather than waiting
+  iov[0].base = buf;
+  iov[0].len = 6;
+  iov[1].base = buf + 6;
+  iov[1].len = 100;
+  if(readv(fds[0], iov, 2) != 8){
+    printf(stdout, "readv pipe failed\n");
+    exit();
+  }
+  buf[8] = 0;
+  if(strcmp(buf, "aaaabbbb") != 0){
+    printf(stdout, "readv pipe wrong data\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  iov[0].base = (void*)0xfffff000;
+  if(writev(1, iov, 1) != -1){
+    printf(stdout, "writev bad pointer ok\n");
+    exit();
+  }
+  printf(stdout, "iov ok\n");
+}
+
+// positional reads and writes leave the shared offset alone
+void
+prwtest(void)
+{
+  int fd, fds[2], i, j, pid;
+  char c;
+
+  printf(stdout, "pread/pwrite test\n");
+  unlink("prwfile");
+  fd = open("prwfile", O_CREATE|O_RDWR);
+  for(i = 0; i < 4; i++){
+    memset(buf, 'a' + i, 1000);
+    if(pwrite(fd, buf, 1000, (3 - i) * 1000) != 1000){
+      printf(stdout, "pwrite failed\n");
+      exit();
+    }
+  }
+  // the descriptor's own offset has not moved
+  if(read(fd, &c, 1) != 1 || c != 'd'){
+    printf(stdout, "pwrite moved the offset\n");
+    exit();
+  }
+
+  // forked readers share fd and take disjoint pieces
+  for(i = 0; i < 4; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(stdout, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      if(pread(fd, buf, 1000, i * 1000) != 1000){
+        printf(stdout, "pread failed\n");
+        exit();
+      }
+      for(j = 0; j < 1000; j++){
+        if(buf[j] != 'd' - i){
+          printf(stdout, "pread: piece %d wrong\n", i);
+          exit();
+        }
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < 4; i++)
+    wait();
+  if(read(fd, &c, 1) != 1 || c != 'd'){
+    printf(stdout, "pread moved the offset\n");
+    exit();
+  }
+  if(pread(fd, buf, 10, 4000) != 0){
+    printf(stdout, "pread past end\n");
+    exit();
+  }
+  close(fd);
+  unlink("prwfile");
+
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  if(pwrite(fds[1], "x", 1, 0) != -1 || pread(fds[0], buf, 1, 0) != -1){
+    printf(stdout, "pread/pwrite on a pipe ok\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  printf(stdout, "pread/pwrite ok\n");
+}
+
+// exec() reads program pages in on first touch, including
+// when the first touch is the kernel's, in a system call
+char lazydata[3*PGSIZE] = { 'x' };
+char lazybss[4*PGSIZE];
+
+void
+demandpagetest(void)
+{
+  int fd, fds[2], i, pid;
+
+  printf(stdout, "demand paging test\n");
+  if(lazydata[0] != 'x' || lazydata[2*PGSIZE] != 0){
+    printf(stdout, "demand paging: data wrong\n");
+    exit();
+  }
+
+  // a pipe copies while holding its lock, so this page must be
+  // read in before that
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  write(fds[1], "pipe", 5);
+  if(read(fds[0], lazybss + PGSIZE, 5) != 5 || strcmp(lazybss + PGSIZE, "pipe") != 0){
+    printf(stdout, "demand paging: pipe read wrong\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  unlink("lazyfile");
+  fd = open("lazyfile", O_CREATE|O_RDWR);
+  if(write(fd, lazydata, PGSIZE) != PGSIZE){
+    printf(stdout, "demand paging: write failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("lazyfile", O_RDONLY);
+  if(read(fd, lazybss + 2*PGSIZE, PGSIZE) != PGSIZE){
+    printf(stdout, "demand paging: read failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("lazyfile");
+  for(i = 0; i < PGSIZE; i++){
+    if(lazybss[2*PGSIZE + i] != lazydata[i]){
+      printf(stdout, "demand paging: file data wrong\n");
+      exit();
+    }
+  }
+
+  // a child reads in what the parent never touched
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(lazybss[3*PGSIZE] != 0 || strcmp(lazybss + PGSIZE, "pipe") != 0){
+      printf(stdout, "demand paging: child sees wrong data\n");
+      exit();
+    }
+    exit();
+  }
+  wait();
+  printf(stdout, "demand paging ok\n");
+}
+
+// processes running the same program share its text pages,
+// and a write to one, even by the kernel, makes a private copy
+char *sharedmsg = "shared text";  // the string is in the text segment
+
+void
+sharedtexttest(void)
+{
+  char *msg = sharedmsg;
+  struct memstat st0, st1;
+  int fds[2], pid;
+
+  printf(stdout, "shared text test\n");
+  if(msg[0] != 's' || memstat(&st0) < 0){
+    printf(stdout, "memstat failed\n");
+    exit();
+  }
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    memstat(&st1);
+    if(st1.text_maps <= st0.text_maps){
+      printf(stdout, "shared text: child not sharing\n");
+      exit();
+    }
+    write(fds[1], "SHARED", 6);
+    if(read(fds[0], msg, 6) != 6 || strcmp(msg, "SHARED text") != 0){
+      printf(stdout, "shared text: write to text failed\n");
+      exit();
+    }
+    exit();
+  }
+  wait();
+  close(fds[0]);
+  close(fds[1]);
+  if(strcmp(msg, "shared text") != 0){
+    printf(stdout, "shared text: child's write seen by parent\n");
+    exit();
+  }
+  printf(stdout, "shared text ok\n");
+}
+
+// sbrk() only reserves memory; pages appear as they are touched
+void
+lazysbrktest(void)
+{
+  struct memstat st0, st1;
+  char *a;
+  int fds[2], pid, i;
+
+  printf(stdout, "lazy sbrk test\n");
+  memstat(&st0);
+  a = sbrk(1024*PGSIZE);
+  if(a == (char*)-1){
+    printf(stdout, "lazy sbrk: sbrk failed\n");
+    exit();
+  }
+  memstat(&st1);
+  if(st1.heap_reserved != st0.heap_reserved + 1024 ||
+     st1.heap_resident != st0.heap_resident){
+    printf(stdout, "lazy sbrk: reserved %d resident %d\n",
+           st1.heap_reserved - st0.heap_reserved,
+           st1.heap_resident - st0.heap_resident);
+    exit();
+  }
+  a[100*PGSIZE] = 'x';
+  if(a[500*PGSIZE] != 0){
+    printf(stdout, "lazy sbrk: page not zero\n");
+    exit();
+  }
+  memstat(&st1);
+  if(st1.heap_resident != st0.heap_resident + 2){
+    printf(stdout, "lazy sbrk: %d pages resident\n", st1.heap_resident - st0.heap_resident);
+    exit();
+  }
+
+  // the kernel can write to a page no one has touched
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  write(fds[1], "heap", 5);
+  if(read(fds[0], a + 700*PGSIZE, 5) != 5 || strcmp(a + 700*PGSIZE, "heap") != 0){
+    printf(stdout, "lazy sbrk: read into heap failed\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < 1024; i += 100)
+      if(a[i*PGSIZE] != (i == 100 ? 'x' : 0)){
+        printf(stdout, "lazy sbrk: child sees wrong data\n");
+        exit();
+      }
+    exit();
+  }
+  wait();
+
+  // more than there is memory for is refused outright
+  if(sbrk(0x7f000000 - (uint)sbrk(0)) != (char*)-1){
+    printf(stdout, "lazy sbrk: overcommitted\n");
+    exit();
+  }
+  sbrk(-1024*PGSIZE);
+  memstat(&st1);
+  if(st1.heap_reserved != st0.heap_reserved){
+    printf(stdout, "lazy sbrk: shrink failed\n");
+    exit();
+  }
+  printf(stdout, "lazy sbrk ok\n");
+}
+
+// small blocks come from size classes, large ones from their
+// own wmap regions, and freed blocks are reused
+void
+malloctest(void)
+{
+  struct wmapinfo wi0, wi1;
+  char *p[64], *q, *big;
+  int i, j;
+
+  printf(stdout, "malloc test\n");
+  for(i = 0; i < 64; i++){
+    if((p[i] = malloc(1 + i * 37)) == 0){
+      printf(stdout, "malloc failed\n");
+      exit();
+    }
+    memset(p[i], i, 1 + i * 37);
+  }
+  for(i = 0; i < 64; i++){
+    for(j = 0; j < 1 + i * 37; j++){
+      if(p[i][j] != i){
+        printf(stdout, "malloc: blocks overlap\n");
+        exit();
+      }
+    }
+  }
+  q = p[10];
+  free(p[10]);
+  if((p[10] = malloc(1 + 10 * 37)) != q){
+    printf(stdout, "malloc: freed block not reused\n");
+    exit();
+  }
+  for(i = 0; i < 64; i++)
+    free(p[i]);
+
+  getwmapinfo(&wi0);
+  if((big = malloc(100*PGSIZE)) == 0){
+    printf(stdout, "malloc: large failed\n");
+    exit();
+  }
+  getwmapinfo(&wi1);
+  if(wi1.total_mmaps != wi0.total_mmaps + 1){
+    printf(stdout, "malloc: large block not in a wmap region\n");
+    exit();
+  }
+  big[0] = 'a';
+  big[100*PGSIZE - 1] = 'b';
+  free(big);
+  getwmapinfo(&wi1);
+  if(wi1.total_mmaps != wi0.total_mmaps){
+    printf(stdout, "malloc: large block not unmapped\n");
+    exit();
+  }
+  printf(stdout, "malloc ok\n");
+}
+
+// pipes come from the kernel's slab cache and go back to it
+void
+slabtest(void)
+{
+  struct memstat st0, st1;
+  int fds[16][2], i, c;
+
+  printf(stdout, "slab test\n");
+  memstat(&st0);
+  for(c = 0; c < st0.ncache; c++)
+    if(strcmp(st0.cache[c].name, "pipecache") == 0)
+      break;
+  if(c == st0.ncache){
+    printf(stdout, "slab: no pipe cache\n");
+    exit();
+  }
+  for(i = 0; i < 16; i++){
+    if(pipe(fds[i]) < 0){
+      printf(stdout, "slab: pipe failed\n");
+      exit();
+    }
+  }
+  memstat(&st1);
+  if(st1.cache[c].inuse != st0.cache[c].inuse + 16 ||
+     st1.cache[c].allocs != st0.cache[c].allocs + 16){
+    printf(stdout, "slab: pipes not counted\n");
+    exit();
+  }
+  for(i = 0; i < 16; i++){
+    close(fds[i][0]);
+    close(fds[i][1]);
+  }
+  memstat(&st1);
+  if(st1.cache[c].inuse != st0.cache[c].inuse){
+    printf(stdout, "slab: pipes not freed\n");
+    exit();
+  }
+  printf(stdout, "slab ok\n");
+}
+
+// an inode nobody holds stays cached, so opening its
+// file again does not fill a new cache entry.
+void
+icachetest(void)
+{
+  struct fsstat st0, st1;
+  int i;
+
+  printf(stdout, "icache test\n");
+  close(open("icfile", O_CREATE|O_RDWR));
+  fsstat(FSSTAT_GET, &st0);
+  for(i = 0; i < 10; i++)
+    close(open("icfile", 0));
+  fsstat(FSSTAT_GET, &st1);
+  if(st1.icache_misses != st0.icache_misses ||
+     st1.icache_hits - st0.icache_hits < 10){
+    printf(stdout, "icache test: %d misses %d hits\n",
+           st1.icache_misses - st0.icache_misses,
+           st1.icache_hits - st0.icache_hits);
+    exit();
+  }
+  unlink("icfile");
+  printf(stdout, "icache test ok\n");
+}
+
+// a process can hold more than NOFILE descriptors, and
+// new ones still take the lowest free number.
+void
+manyfdtest(void)
+{
+  int fd, i, pid;
+
+  printf(stdout, "manyfd test\n");
+  if((pid = fork()) < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 3; i < 100; i++){
+      if((fd = dup(0)) != i){
+        printf(stdout, "manyfd: dup gave %d not %d\n", fd, i);
+        exit();
+      }
+    }
+    close(7);
+    close(50);
+    if(dup(0) != 7 || dup(0) != 50 || dup(0) != 100){
+      printf(stdout, "manyfd: freed fd not reused\n");
+      exit();
+    }
+    if((pid = fork()) == 0){
+      if(write(99, "", 0) != 0 || close(100) != 0){
+        printf(stdout, "manyfd: fds not inherited\n");
+        exit();
+      }
+      printf(stdout, "manyfd test ok\n");
+      exit();
+    }
+    wait();
+    exit();
+  }
+  wait();
+}
+
+// a page dropped by shrinking a mapping can't be reached
+// through a stale TLB entry.
+void
+unmaptest(void)
+{
+  int fds[2], pid;
+  char *p, c;
+
+  printf(stdout, "unmap test\n");
+  if(pipe(fds) < 0 || (pid = fork()) < 0){
+    printf(stdout, "unmap: pipe/fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    p = (char*)wmap(0, 2*PGSIZE, MAP_ANONYMOUS|MAP_PRIVATE, -1);
+    if(p == (char*)FAILED){
+      printf(stdout, "unmap: wmap failed\n");
+      exit();
+    }
+    p[0] = 1;
+    p[PGSIZE] = 2;
+    if(wremap((uint)p, 2*PGSIZE, PGSIZE, 0) != (uint)p){
+      printf(stdout, "unmap: wremap failed\n");
+      exit();
+    }
+    c = p[PGSIZE];  // should be killed here
+    write(fds[1], &c, 1);
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 0){
+    printf(stdout, "unmap: freed page still mapped\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+  printf(stdout, "unmap test ok\n");
+}
+
+// unmapping pages while another thread of the process runs
+// sends it TLB shootdowns, each of which gets answered.
+volatile int shootstop;
+
+void
+shootspin(void *arg1, void *arg2)
+{
+  while(!shootstop)
+    ;
+  exit();
+}
+
+void
+shootdowntest(void)
+{
+  struct memstat st;
+  char *p;
+  int i;
+
+  printf(stdout, "shootdown test\n");
+  shootstop = 0;
+  if(thread_create(shootspin, 0, 0) < 0){
+    printf(stdout, "shootdown: thread_create failed\n");
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    p = (char*)wmap(0, 4*PGSIZE, MAP_ANONYMOUS|MAP_PRIVATE, -1);
+    if(p == (char*)FAILED){
+      printf(stdout, "shootdown: wmap failed\n");
+      exit();
+    }
+    p[0] = p[3*PGSIZE] = i;
+    if(wunmap((uint)p) < 0){
+      printf(stdout, "shootdown: wunmap failed\n");
+      exit();
+    }
+  }
+  shootstop = 1;
+  thread_join();
+  memstat(&st);
+  if(st.tlb_sent != st.tlb_received){
+    printf(stdout, "shootdown: %d sent %d answered\n",
+           st.tlb_sent, st.tlb_received);
+    exit();
+  }
+  printf(stdout, "shootdown test ok\n");
+}
+
+// making and tearing down address spaces gives back every page.
+void
+vmfreetest(void)
+{
+  struct memstat st0, st1;
+  int i, pid;
+
+  printf(stdout, "vmfree test\n");
+  memstat(&st0);
+  for(i = 0; i < 20; i++){
+    if((pid = fork()) < 0){
+      printf(stdout, "vmfree: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      sbrk(10*PGSIZE)[5*PGSIZE] = 1;
+      exit();
+    }
+    wait();
+  }
+  memstat(&st1);
+  if(st1.free_pages + 4 < st0.free_pages){
+    printf(stdout, "vmfree: %d pages lost\n",
+           st0.free_pages - st1.free_pages);
+    exit();
+  }
+  printf(stdout, "vmfree test ok\n");
+}
+
+// the program of a running process can't be written, since
+// it reads its pages from the file as it goes.
+void
+textbusytest(void)
+{
+  int fd;
+  char c;
+
+  printf(stdout, "text busy test\n");
+  if((fd = open("usertests", O_RDWR)) < 0 || pread(fd, &c, 1, 0) != 1){
+    printf(stdout, "text busy: open failed\n");
+    exit();
+  }
+  if(pwrite(fd, &c, 1, 0) != -1){
+    printf(stdout, "text busy: wrote a running program\n");
+    exit();
+  }
+  close(fd);
+  printf(stdout, "text busy test ok\n");
+}
+
+// small appends wait in the cache for their blocks, read
+// back before and after sync, and sync allocates them.
+void
+delaytest(void)
+{
+  struct fsstat st0, st1;
+  int fd, i, j;
+
+  printf(stdout, "delay test\n");
+  unlink("dlfile");
+  sync();
+  fsstat(FSSTAT_GET, &st0);
+  if((fd = open("dlfile", O_CREATE|O_RDWR)) < 0){
+    printf(stdout, "delay: create failed\n");
+    exit();
+  }
+  for(i = 0; i < 64; i++){
+    memset(buf, i, 512);
+    if(write(fd, buf, 512) != 512){
+      printf(stdout, "delay: write failed\n");
+      exit();
+    }
+  }
+  for(j = 0; j < 2; j++){
+    for(i = 0; i < 64; i++){
+      if(pread(fd, buf, 512, i*512) != 512 || buf[0] != i || buf[511] != i){
+        printf(stdout, "delay: bad data at %d\n", i*512);
+        exit();
+      }
+    }
+    sync();
+  }
+  fsstat(FSSTAT_GET, &st1);
+  if(st1.delay_allocs - st0.delay_allocs < 64*512/BSIZE){
+    printf(stdout, "delay: %d blocks allocated\n",
+           st1.delay_allocs - st0.delay_allocs);
+    exit();
+  }
+  close(fd);
+  unlink("dlfile");
+  printf(stdout, "delay test ok\n");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -1737,6 +2603,257 @@ void argptest()
   printf(1, "arg test passed\n");
 }
 
+// threads created by clone() share memory and are reaped by join().
+#define NTHREADTEST 4
+lock_t threadlock;
+int threadcount;
+
+void
+threadworker(void *arg1, void *arg2)
+{
+  int i, n;
+
+  n = (int)arg1;
+  for(i = 0; i < n; i++){
+    lock_acquire(&threadlock);
+    threadcount++;
+    lock_release(&threadlock);
+  }
+  *(int*)arg2 = getpid();
+  exit();
+}
+
+void
+threadtest(void)
+{
+  int i, pids[NTHREADTEST], seen[NTHREADTEST];
+
+  printf(stdout, "thread test\n");
+  lock_init(&threadlock);
+  threadcount = 0;
+  for(i = 0; i < NTHREADTEST; i++){
+    seen[i] = 0;
+    pids[i] = thread_create(threadworker, (void*)1000, &seen[i]);
+    if(pids[i] < 0){
+      printf(stdout, "thread_create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < NTHREADTEST; i++){
+    if(thread_join() < 0){
+      printf(stdout, "thread_join failed\n");
+      exit();
+    }
+  }
+  if(thread_join() != -1){
+    printf(stdout, "thread_join got too many\n");
+    exit();
+  }
+  if(threadcount != NTHREADTEST*1000){
+    printf(stdout, "thread test lost updates: %d\n", threadcount);
+    exit();
+  }
+  for(i = 0; i < NTHREADTEST; i++){
+    if(seen[i] != pids[i]){
+      printf(stdout, "thread %d did not run\n", pids[i]);
+      exit();
+    }
+  }
+  printf(stdout, "thread test ok\n");
+}
+
+// futex-backed mutex and condition variable between threads.
+mutex_t futexmutex;
+cond_t futexcond;
+int futexitems;
+int futexsum;
+
+void
+futexconsumer(void *arg1, void *arg2)
+{
+  int i, n;
+
+  n = (int)arg1;
+  for(i = 0; i < n; i++){
+    mutex_lock(&futexmutex);
+    while(futexitems == 0)
+      cond_wait(&futexcond, &futexmutex);
+    futexitems--;
+    futexsum++;
+    mutex_unlock(&futexmutex);
+  }
+  exit();
+}
+
+void
+futextest(void)
+{
+  int i, n;
+
+  printf(stdout, "futex test\n");
+  n = 500;
+  mutex_init(&futexmutex);
+  cond_init(&futexcond);
+  futexitems = 0;
+  futexsum = 0;
+  if(thread_create(futexconsumer, (void*)n, 0) < 0 ||
+     thread_create(futexconsumer, (void*)n, 0) < 0){
+    printf(stdout, "futex test thread_create failed\n");
+    exit();
+  }
+  for(i = 0; i < 2*n; i++){
+    mutex_lock(&futexmutex);
+    futexitems++;
+    cond_signal(&futexcond);
+    mutex_unlock(&futexmutex);
+  }
+  if(thread_join() < 0 || thread_join() < 0){
+    printf(stdout, "futex test thread_join failed\n");
+    exit();
+  }
+  if(futexsum != 2*n || futexitems != 0){
+    printf(stdout, "futex test lost items: %d %d\n", futexsum, futexitems);
+    exit();
+  }
+  if(futex(&futexsum, FUTEX_WAIT, futexsum + 1) != -1){
+    printf(stdout, "futex wait on changed value should fail\n");
+    exit();
+  }
+  printf(stdout, "futex test ok\n");
+}
+
+// directory name cache: repeated lookups hit, and cached
+// entries follow creates, unlinks and inode number reuse.
+void
+dcachetest(void)
+{
+  struct fsstat st0, st1;
+  int i, bad;
+
+  printf(stdout, "dcache test\n");
+  mkdir("dcdir");
+  close(open("dcdir/f", O_CREATE|O_RDWR));
+  fsstat(FSSTAT_GET, &st0);
+  for(i = 0; i < 10; i++)
+    close(open("dcdir/f", 0));
+  fsstat(FSSTAT_GET, &st1);
+  bad = st1.dcache_hits - st0.dcache_hits < 10;
+
+  bad |= open("dcdir/g", 0) >= 0;
+  close(open("dcdir/g", O_CREATE|O_RDWR));
+  bad |= unlink("dcdir/g") < 0 || unlink("dcdir/f") < 0;
+  bad |= open("dcdir/f", 0) >= 0 || unlink("dcdir") < 0;
+  mkdir("dcdir2");  // may reuse dcdir's inode number
+  bad |= open("dcdir2/g", 0) >= 0 || unlink("dcdir2") < 0;
+  if(bad){
+    printf(stdout, "dcache test failed\n");
+    exit();
+  }
+  printf(stdout, "dcache test ok\n");
+}
+
+// hashed directories: names that all fall in one bucket
+// spill into a chain of blocks and can still be found.
+void
+hashdirtest(void)
+{
+  char path[16];
+  struct dirent de;
+  int i, n, fd, bucket;
+
+  printf(stdout, "hashdir test\n");
+  if(mkdir("hd") < 0 || (fd = open("hd/f", O_CREATE|O_RDWR)) < 0){
+    printf(stdout, "hashdir test create failed\n");
+    exit();
+  }
+  close(fd);
+
+  strcpy(path, "hd/");
+  bucket = dirhash("f") % NDIRBUCKET;
+  n = 0;
+  for(i = 0; n < 2*DPB; i++){
+    path[3] = 'a' + i/676 % 26;
+    path[4] = 'a' + i/26 % 26;
+    path[5] = 'a' + i % 26;
+    path[6] = 0;
+    if(dirhash(path+3) % NDIRBUCKET != bucket)
+      continue;
+    if(link("hd/f", path) < 0 || (fd = open(path, 0)) < 0){
+      printf(stdout, "hashdir test link %s failed\n", path);
+      exit();
+    }
+    close(fd);
+    n++;
+  }
+
+  // ".", "..", "f" and the links
+  fd = open("hd", 0);
+  i = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0)
+      i++;
+  close(fd);
+  if(i != n + 3){
+    printf(stdout, "hashdir test: %d entries, expected %d\n", i, n + 3);
+    exit();
+  }
+
+  if(unlink("hd") == 0){
+    printf(stdout, "hashdir test: unlinked non-empty directory\n");
+    exit();
+  }
+  for(i = 0; n > 0; i++){
+    path[3] = 'a' + i/676 % 26;
+    path[4] = 'a' + i/26 % 26;
+    path[5] = 'a' + i % 26;
+    if(dirhash(path+3) % NDIRBUCKET != bucket)
+      continue;
+    if(unlink(path) < 0){
+      printf(stdout, "hashdir test unlink %s failed\n", path);
+      exit();
+    }
+    n--;
+  }
+  if(unlink("hd/f") < 0 || unlink("hd") < 0){
+    printf(stdout, "hashdir test: cannot remove hd\n");
+    exit();
+  }
+  printf(stdout, "hashdir test ok\n");
+}
+
+// small appends are committed together rather than one
+// transaction per write().
+void
+writebacktest(void)
+{
+  struct fsstat st0, st1;
+  int i, fd;
+
+  printf(stdout, "writeback test\n");
+  if((fd = open("wbfile", O_CREATE|O_RDWR)) < 0){
+    printf(stdout, "writeback test create failed\n");
+    exit();
+  }
+  sync();
+  fsstat(FSSTAT_GET, &st0);
+  for(i = 0; i < 200; i++){
+    if(write(fd, "0123456789abcdef", 16) != 16){
+      printf(stdout, "writeback test write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  sync();
+  fsstat(FSSTAT_GET, &st1);
+  if(st1.log_commits - st0.log_commits > 20){
+    printf(stdout, "writeback test: %d commits for 200 writes\n",
+           st1.log_commits - st0.log_commits);
+    exit();
+  }
+  unlink("wbfile");
+  printf(stdout, "writeback test ok\n");
+}
+
 unsigned long randstate = 1;
 unsigned int
 rand()
@@ -1773,6 +2890,7 @@ main(int argc, char *argv[])
   opentest();
   writetest();
   writetest1();
+  extenttest();
   createtest();
 
   openiputtest();
@@ -1781,6 +2899,22 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  pipepages();
+  splicetest();
+  iovtest();
+  prwtest();
+  demandpagetest();
+  sharedtexttest();
+  lazysbrktest();
+  malloctest();
+  slabtest();
+  icachetest();
+  manyfdtest();
+  unmaptest();
+  shootdowntest();
+  vmfreetest();
+  textbusytest();
+  delaytest();
   preempt();
   exitwait();
 
@@ -1793,6 +2927,11 @@ main(int argc, char *argv[])
   dirfile();
   iref();
   forktest();
+  threadtest();
+  futextest();
+  dcachetest();
+  hashdirtest();
+  writebacktest();
   bigdir(); // slow
 
   uio();
@@ -6,22 +6,44 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "traps.h"
 #include "spinlock.h"
 #include "wmap.h"
 #include "fs.h"
 #include "sleeplock.h"
+#include "share.h"
 #include "file.h"
 #include "stat.h"
 #include "fcntl.h"
+#include "memstat.h"
 
 extern char data[]; // defined by kernel.ld
 pde_t *kpgdir;      // for use in scheduler()
+extern void sysenter_entry(void); // in trapasm.S
+static int havesysenter;          // CPU supports sysenter/sysexit
+static struct spinlock pageinlock; // orders pagein() mappings
+static struct kmem_cache *wmapcache; // struct wmap_region
+
+#define NINVLPG 32    // most pages a TLB flush invalidates one by one
+#define NUNMAPFREE 64 // pages unmaprange() frees per TLB flush
+
+// The TLB shootdown in progress, if any.  Each CPU in pending
+// flushes its TLB and clears its bit.
+static struct
+{
+  struct spinlock lock;  // one shootdown at a time
+  pde_t *pgdir;          // page table whose entries changed
+  uint va[NINVLPG];      // addresses to invalidate
+  int n;                 // entries in va; all if more than NINVLPG
+  volatile uint pending; // CPUs yet to answer, one bit per cpuid()
+} shootdown;
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void seginit(void)
 {
   struct cpu *c;
+  uint edx;
 
   // Map "logical" addresses to virtual addresses using identity map.
   // Cannot share a CODE descriptor for both kernel and user
@@ -33,6 +55,17 @@ void seginit(void)
   c->gdt[SEG_UCODE] = SEG(STA_X | STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
   lgdt(c->gdt, sizeof(c->gdt));
+
+  // Fast system call entry. The stack is per-process and is
+  // loaded by switchuvm. Without SEP, sysenter traps as an
+  // illegal opcode and trap() falls back to the int path.
+  cpuidinfo(1, 0, 0, 0, &edx);
+  if (edx & CPUID_SEP)
+  {
+    havesysenter = 1;
+    wrmsr(MSR_SYSENTER_CS, SEG_KCODE << 3, 0);
+    wrmsr(MSR_SYSENTER_EIP, (uint)sysenter_entry, 0);
+  }
 }
 
 // Return the address of the PTE in page table pgdir
@@ -110,7 +143,9 @@ int mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // (directly addressable from end..P2V(PHYSTOP)).
 
 // This table defines the kernel's mappings, which are present in
-// every process's page table.
+// every process's page table.  Only kpgdir gets page-table pages
+// of its own for them; every other page table points at those,
+// so making and freeing one touches only its user part.
 static struct kmap
 {
   void *virt;
@@ -134,6 +169,12 @@ setupkvm(void)
   if ((pgdir = (pde_t *)kalloc()) == 0)
     return 0;
   memset(pgdir, 0, PGSIZE);
+  if (kpgdir)
+  {
+    memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+            (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
+    return pgdir;
+  }
   if (P2V(PHYSTOP) > (void *)DEVSPACE)
     panic("PHYSTOP too high");
   for (k = kmap; k < &kmap[NELEM(kmap)]; k++)
@@ -152,6 +193,15 @@ void kvmalloc(void)
 {
   kpgdir = setupkvm();
   switchkvm();
+  initlock(&pageinlock, "pagein");
+  initlock(&shootdown.lock, "shootdown");
+  wmapcache = kmem_cache_create("wmap_region", sizeof(struct wmap_region));
+}
+
+// Allocate an uninitialized wmap_region.
+struct wmap_region *wmapregionalloc(void)
+{
+  return kmem_cache_alloc(wmapcache);
 }
 
 // Switch h/w page table register to the kernel-only page table,
@@ -181,6 +231,8 @@ void switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort)0xFFFF;
   ltr(SEG_TSS << 3);
+  if (havesysenter)
+    wrmsr(MSR_SYSENTER_ESP, (uint)p->kstack + KSTACKSIZE, 0);
   lcr3(V2P(p->pgdir)); // switch to process's address space
   popcli();
 }
@@ -223,6 +275,147 @@ int loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
   return 0;
 }
 
+// Free the user page mem, mapped with PTE flags flags.
+static void freeupage(char *mem, uint flags)
+{
+  if (flags & PTE_TEXT)
+    textput(mem);
+  else
+    kfree(mem);
+}
+
+// Fill mem with the page at va of segment s of ip.
+// Caller holds ip->lock.
+static int fillpage(struct inode *ip, struct vmseg *s, uint va, char *mem)
+{
+  uint lo, hi;
+
+  memset(mem, 0, PGSIZE);
+  lo = va > s->vaddr ? va : s->vaddr;
+  hi = va + PGSIZE < s->vaddr + s->filesz ? va + PGSIZE : s->vaddr + s->filesz;
+  if (lo < hi && readi(ip, mem + (lo - va), s->off + (lo - s->vaddr), hi - lo) != hi - lo)
+    return -1;
+  return 0;
+}
+
+// Make the page of p holding va present.  Pages in segments
+// exec() left to be loaded on demand are read from the program
+// image, those of read-only segments through the shared text
+// cache; any other page below p's size, such as heap that sbrk()
+// only reserved, is zero-filled.  Returns 0 if the page is
+// present afterwards, -1 if va is above p's size or the page
+// could not be loaded.
+int pagein(struct proc *p, uint va)
+{
+  struct vmseg *s;
+  pte_t *pte;
+  char *mem;
+  uint perm;
+
+  va = PGROUNDDOWN(va);
+  if (p->sh == 0 || va >= p->sh->sz)
+    return -1;
+  for (s = p->seg; s < &p->seg[p->nseg]; s++)
+    if (va >= s->start && va < s->end)
+      break;
+  if ((pte = walkpgdir(p->pgdir, (char *)va, 0)) != 0 && (*pte & PTE_P))
+    return 0;
+
+  perm = PTE_W | PTE_U;
+  if (s == &p->seg[p->nseg])
+  {
+    if ((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    goto map;
+  }
+
+  ilock(p->exe);
+  if (!s->writable && (mem = textget(p->exe, va)) != 0)
+    perm = PTE_U | PTE_TEXT;
+  else if ((mem = kalloc()) != 0)
+  {
+    if (fillpage(p->exe, s, va, mem) < 0)
+    {
+      kfree(mem);
+      mem = 0;
+    }
+    else if (!s->writable && textadd(p->exe, va, mem) == 0)
+      perm = PTE_U | PTE_TEXT;
+  }
+  iunlock(p->exe);
+  if (mem == 0)
+    return -1;
+
+map:
+  // Another thread sharing the page table may have got here first.
+  acquire(&pageinlock);
+  if ((pte = walkpgdir(p->pgdir, (char *)va, 0)) != 0 && (*pte & PTE_P))
+  {
+    release(&pageinlock);
+    freeupage(mem, perm);
+    return 0;
+  }
+  if (mappages(p->pgdir, (char *)va, PGSIZE, V2P(mem), perm) < 0)
+  {
+    release(&pageinlock);
+    freeupage(mem, perm);
+    return -1;
+  }
+  release(&pageinlock);
+  return 0;
+}
+
+// Give p, the current process, a private writable copy of the
+// shared text page at va, which it is writing to.  Returns -1
+// if va is not a shared text page.
+int unsharetext(struct proc *p, uint va)
+{
+  pte_t *pte;
+  char *mem, *old;
+
+  acquire(&pageinlock);
+  pte = walkpgdir(p->pgdir, (char *)va, 0);
+  if (pte == 0 || (*pte & (PTE_P | PTE_U)) != (PTE_P | PTE_U))
+  {
+    release(&pageinlock);
+    return -1;
+  }
+  if (!(*pte & PTE_TEXT))
+  {
+    // Another thread already made the copy.
+    release(&pageinlock);
+    return (*pte & PTE_W) ? 0 : -1;
+  }
+  if ((mem = kalloc()) == 0)
+  {
+    release(&pageinlock);
+    return -1;
+  }
+  old = P2V(PTE_ADDR(*pte));
+  memmove(mem, old, PGSIZE);
+  *pte = V2P(mem) | PTE_P | PTE_W | PTE_U;
+  release(&pageinlock);
+  tlbinval(p->pgdir, &va, 1);
+  textput(old);
+  return 0;
+}
+
+// Read in any not-yet-loaded pages of p covering [va, va+n),
+// for kernel code about to touch user memory, which must not
+// fault there: it may hold a spinlock, and a fault the kernel
+// takes cannot fail.  Returns -1 if a page could not be read
+// in, and then the range must be left alone.
+int prefault(struct proc *p, uint va, uint n)
+{
+  uint a;
+
+  for (a = PGROUNDDOWN(va); a < va + n; a += PGSIZE)
+    if (pagein(p, a) < 0)
+      return -1;
+  return 0;
+}
+
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
@@ -257,53 +450,212 @@ int allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
-// Deallocate user pages to bring the process size from oldsz to
-// newsz.  oldsz and newsz need not be page-aligned, nor does newsz
-// need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
-int deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+// Invalidate this CPU's TLB entries for the n addresses in va,
+// or all of them if n > NINVLPG, if it is using pgdir.
+static void tlbflush(pde_t *pgdir, uint *va, int n)
 {
-  pte_t *pte;
-  uint a, pa;
+  int i;
 
-  if (newsz >= oldsz)
-    return oldsz;
+  if (n == 0 || rcr3() != V2P(pgdir))
+    return;
+  if (n > NINVLPG)
+    lcr3(V2P(pgdir));
+  else
+    for (i = 0; i < n; i++)
+      invlpg((void *)va[i]);
+}
+
+// The entries of pgdir for the n addresses in va (all of them
+// if n > NINVLPG) have changed: flush them from the TLB of
+// every CPU using pgdir.  Other CPUs get one IPI for the whole
+// batch, and this waits until each has answered, so pages that
+// were unmapped can be freed afterwards.
+void tlbinval(pde_t *pgdir, uint *va, int n)
+{
+  struct cpu *c, *me;
+  uint mask;
+
+  if (n == 0)
+    return;
+  pushcli();
+  me = mycpu();
+  tlbflush(pgdir, va, n);
+
+  // The entries must change before we look at what others run:
+  // a CPU that switches to pgdir later starts with a clean TLB.
+  __sync_synchronize();
+  mask = 0;
+  for (c = cpus; c < &cpus[ncpu]; c++)
+    if (c != me && c->proc && c->proc->pgdir == pgdir)
+      mask |= 1 << (c - cpus);
+  if (mask == 0)
+  {
+    popcli();
+    return;
+  }
+
+  acquire(&shootdown.lock);
+  shootdown.pgdir = pgdir;
+  shootdown.n = n;
+  if (n <= NINVLPG)
+    memmove(shootdown.va, va, n * sizeof(va[0]));
+  shootdown.pending = mask;
+  for (c = cpus; c < &cpus[ncpu]; c++)
+  {
+    if (mask & (1 << (c - cpus)))
+    {
+      lapicipi(c->apicid, T_TLBFLUSH);
+      me->tlbsent++;
+    }
+  }
+  while (shootdown.pending)
+    ;
+  release(&shootdown.lock);
+  popcli();
+}
+
+// Answer the TLB shootdown in progress if it is aimed at this
+// CPU.  Called with interrupts off, from the IPI and while
+// spinning for a lock, since the sender may hold that lock.
+void tlbpoll(void)
+{
+  uint bit;
+
+  if (shootdown.pending == 0)
+    return;
+  bit = 1 << cpuid();
+  if (!(shootdown.pending & bit))
+    return;
+  tlbflush(shootdown.pgdir, shootdown.va, shootdown.n);
+  mycpu()->tlbrecv++;
+  __sync_fetch_and_and(&shootdown.pending, ~bit);
+}
+
+void tlbstat(struct memstat *st)
+{
+  struct cpu *c;
+
+  st->tlb_sent = st->tlb_received = 0;
+  for (c = cpus; c < &cpus[ncpu]; c++)
+  {
+    st->tlb_sent += c->tlbsent;
+    st->tlb_received += c->tlbrecv;
+  }
+}
+
+// Changes unmaprange() has made but not yet flushed from
+// TLBs, and the pages to free once it has.
+struct unmapbatch
+{
+  uint va[NINVLPG];      // addresses unmapped
+  int n;                 // how many; may exceed NINVLPG
+  uint mem[NUNMAPFREE];  // pages to free, low bit set for text
+  int nmem;
+};
+
+static void unmapflush(pde_t *pgdir, struct unmapbatch *b)
+{
+  int i;
 
-  a = PGROUNDUP(newsz);
-  for (; a < oldsz; a += PGSIZE)
+  tlbinval(pgdir, b->va, b->n);
+  for (i = 0; i < b->nmem; i++)
+    freeupage((char *)(b->mem[i] & ~1), (b->mem[i] & 1) ? PTE_TEXT : 0);
+  b->n = b->nmem = 0;
+}
+
+// Remove the mappings of the user pages in [va, end) from pgdir,
+// freeing the pages as well if dofree is set, and free any
+// page-table page left with no mappings.  Each page-table page
+// is looked up once.  The TLBs of CPUs using pgdir are flushed
+// in batches (see tlbinval), each before the pages it covers
+// are freed.
+void unmaprange(pde_t *pgdir, uint va, uint end, int dofree)
+{
+  struct unmapbatch b;
+  pde_t *pde;
+  pte_t *pgtab, *pte;
+  uint a, lim;
+  int i;
+
+  if (end > KERNBASE)
+    end = KERNBASE;
+  b.n = b.nmem = 0;
+  acquire(&pageinlock);
+  for (a = PGROUNDDOWN(va); a < end; a = lim)
   {
-    pte = walkpgdir(pgdir, (char *)a, 0);
-    if (!pte)
-      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-    else if ((*pte & PTE_P) != 0)
+    lim = PGADDR(PDX(a) + 1, 0, 0);
+    if (lim > end)
+      lim = end;
+    pde = &pgdir[PDX(a)];
+    if (!(*pde & PTE_P))
+      continue;
+    pgtab = (pte_t *)P2V(PTE_ADDR(*pde));
+    for (pte = &pgtab[PTX(a)]; a < lim; a += PGSIZE, pte++)
     {
-      pa = PTE_ADDR(*pte);
-      if (pa == 0)
-        panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
+      if (*pte == 0)
+        continue;
+      if ((*pte & PTE_P) && dofree)
+      {
+        if (PTE_ADDR(*pte) == 0)
+          panic("unmaprange");
+        if (b.nmem == NUNMAPFREE)
+          unmapflush(pgdir, &b);
+        b.mem[b.nmem++] = (uint)P2V(PTE_ADDR(*pte)) | ((*pte & PTE_TEXT) != 0);
+      }
       *pte = 0;
+      if (b.n < NINVLPG)
+        b.va[b.n] = a;
+      b.n++;
+    }
+    for (i = 0; i < NPTENTRIES && pgtab[i] == 0; i++)
+      ;
+    if (i == NPTENTRIES)
+    {
+      *pde = 0;
+      if (b.nmem == NUNMAPFREE)
+        unmapflush(pgdir, &b);
+      b.mem[b.nmem++] = (uint)pgtab;
+      if (b.n < NINVLPG)
+        b.va[b.n] = a - PGSIZE;
+      b.n++;
     }
   }
+  unmapflush(pgdir, &b);
+  release(&pageinlock);
+}
+
+// Deallocate user pages to bring the process size from oldsz to
+// newsz.  oldsz and newsz need not be page-aligned, nor does newsz
+// need to be less than oldsz.  oldsz can be larger than the actual
+// process size.  Returns the new process size.
+int deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  if (newsz >= oldsz)
+    return oldsz;
+  unmaprange(pgdir, PGROUNDUP(newsz), oldsz, 1);
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part, visiting only the page-table pages there
+// are.  The kernel part is shared (see setupkvm) and stays.
+// pgdir must not be in use on any CPU.
 void freevm(pde_t *pgdir)
 {
-  uint i;
+  pte_t *pgtab;
+  uint i, j;
 
   if (pgdir == 0)
     panic("freevm: no pgdir");
-  deallocuvm(pgdir, KERNBASE, 0); // maybe change because bad
-  for (i = 0; i < NPDENTRIES; i++)
+  for (i = 0; i < PDX(KERNBASE); i++)
   {
-    if (pgdir[i] & PTE_P)
-    {
-      char *v = P2V(PTE_ADDR(pgdir[i]));
-      kfree(v);
-    }
+    if (!(pgdir[i] & PTE_P))
+      continue;
+    pgtab = (pte_t *)P2V(PTE_ADDR(pgdir[i]));
+    for (j = 0; j < NPTENTRIES; j++)
+      if (pgtab[j] & PTE_P)
+        freeupage(P2V(PTE_ADDR(pgtab[j])), pgtab[j]);
+    kfree((char *)pgtab);
   }
   kfree((char *)pgdir);
 }
@@ -320,6 +672,26 @@ void clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Map the kernel page mem at uva in place of the user page
+// there, and return the replaced page for the caller to reuse.
+// Returns 0, changing nothing, unless uva is a writable user
+// page.  pgdir must be the current page table.
+char *
+swapupage(pde_t *pgdir, char *uva, char *mem)
+{
+  pte_t *pte;
+  char *old;
+
+  if ((pte = walkpgdir(pgdir, uva, 0)) == 0)
+    return 0;
+  if ((*pte & (PTE_P | PTE_W | PTE_U)) != (PTE_P | PTE_W | PTE_U))
+    return 0;
+  old = P2V(PTE_ADDR(*pte));
+  *pte = V2P(mem) | PTE_FLAGS(*pte);
+  invlpg(uva);
+  return old;
+}
+
 // Given a parent process's page table, create a copy
 // of it for a child.
 pde_t *
@@ -334,18 +706,24 @@ copyuvm(pde_t *pgdir, uint sz)
     return 0;
   for (i = 0; i < sz; i += PGSIZE)
   {
-    if ((pte = walkpgdir(pgdir, (void *)i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if (!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    // A page not read in yet is left for the child to read in.
+    if ((pte = walkpgdir(pgdir, (void *)i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if ((mem = kalloc()) == 0)
+    if (flags & PTE_TEXT)
+    {
+      // Shared text: map the same page.
+      mem = P2V(pa);
+      textdup(mem);
+    }
+    else if ((mem = kalloc()) == 0)
       goto bad;
-    memmove(mem, (char *)P2V(pa), PGSIZE);
+    else
+      memmove(mem, (char *)P2V(pa), PGSIZE);
     if (mappages(d, (void *)i, PGSIZE, V2P(mem), flags) < 0)
     {
-      kfree(mem);
+      freeupage(mem, flags);
       goto bad;
     }
   }
@@ -364,10 +742,13 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if ((*pte & PTE_P) == 0)
+  if (pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if ((*pte & PTE_U) == 0)
     return 0;
+  // Writing shared text here would change it for everyone.
+  if (*pte & PTE_TEXT)
+    return 0;
   return (char *)P2V(PTE_ADDR(*pte));
 }
 
@@ -405,7 +786,7 @@ int region_overlaps(struct proc *curproc, uint addr, int length)
   uint end_addr = addr + length;
   for (i = 0; i < 16; i++)
   {
-    wmap_region = curproc->wmap_regions[i];
+    wmap_region = curproc->sh->wmap_regions[i];
     if (wmap_region != 0)
     {
       uint wmap_start = wmap_region->addr;
@@ -421,7 +802,7 @@ int region_overlaps(struct proc *curproc, uint addr, int length)
   return 0; // The region does not overlap
 }
 
-// Memory map system call
+// Memory map system call.  The caller holds myproc()->sh->lock.
 uint wmap(uint addr, int length, int flags, int fd)
 {
   struct proc *curproc = myproc();
@@ -456,13 +837,38 @@ uint wmap(uint addr, int length, int flags, int fd)
     }
   }
 
+  // The kernel's page tables are shared by every process, so no
+  // user mapping may reach into them.
+  if (length <= 0 || addr + length > KERNBASE)
+  {
+    return -1;
+  }
+
+  // A file-backed mapping needs a readable file; check it before
+  // allocating a region, so failing leaves nothing behind.
+  if (!(flags & MAP_ANONYMOUS))
+  {
+    struct file *f;
+    int readable;
+    if ((f = ofileget(curproc->sh, fd)) == 0)
+    {
+      return -1;
+    }
+    readable = f->readable;
+    fileclose(f);
+    if (!readable)
+    {
+      return -1;
+    }
+  }
+
   struct wmap_region *wmap_region;
   int i;
   for (i = 0; i < 16; i++)
   {
-    if (curproc->wmap_regions[i] == 0)
+    if (curproc->sh->wmap_regions[i] == 0)
     {
-      wmap_region = (struct wmap_region *)kalloc();
+      wmap_region = wmapregionalloc();
       if (wmap_region == 0)
       {
         return -1;
@@ -473,32 +879,14 @@ uint wmap(uint addr, int length, int flags, int fd)
       wmap_region->flags = flags;
       wmap_region->fd = fd;
       wmap_region->ref_count = 1;
-
-      // Handle flags
-      if (flags & MAP_ANONYMOUS)
-      {
-        curproc->wmap_regions[i] = wmap_region;
-        return addr; // Return the address of the memory region
-      }
-      else
-      {
-        struct file *f;
-        if (fd < 0 || fd >= NOFILE || (f = curproc->ofile[fd]) == 0 || !(f->readable))
-        {
-          return -1;
-        }
-        if (flags & MAP_SHARED || flags & MAP_PRIVATE)
-        {
-          curproc->wmap_regions[i] = wmap_region;
-          return addr; // Return the address of the memory region
-        }
-      }
+      curproc->sh->wmap_regions[i] = wmap_region;
+      return addr; // Return the address of the memory region
     }
   }
   return -1;
 }
 
-// Memory unmap system call
+// Memory unmap system call.  The caller holds myproc()->sh->lock.
 int wunmap(uint addr)
 {
   struct proc *curproc = myproc();
@@ -510,57 +898,45 @@ int wunmap(uint addr)
   }
 
   struct wmap_region *wmap_region;
-  int i;
+  int i, last;
   for (i = 0; i < 16; i++)
   {
-    wmap_region = curproc->wmap_regions[i];
+    wmap_region = curproc->sh->wmap_regions[i];
     if (wmap_region != 0 && wmap_region->addr == addr)
     {
       // If it's a file-backed mapping with MAP_SHARED, write the memory data back to the file
       if (!(wmap_region->flags & MAP_ANONYMOUS) && (wmap_region->flags & MAP_SHARED))
       {
-        struct file *f = curproc->ofile[wmap_region->fd];
-        if (f == 0)
+        // A descriptor closed since wmap() leaves nothing to write to.
+        struct file *f = ofileget(curproc->sh, wmap_region->fd);
+        if (f != 0)
         {
-          return -1; // Invalid file descriptor
-        }
-
-        uint temp = f->off;
-        f->off = 0;
-
-        // Write the memory data back to the file
-        int written = filewrite(f, (char *)addr, wmap_region->length);
-        if (written != wmap_region->length)
-        {
-          return -1; // Writing the memory data back to the file failed
-        }
+          uint temp = f->off;
+          f->off = 0;
 
-        f->off = temp;
-      }
-
-      // Free the physical memory
-      pte_t *pte;
-
-      for (uint a = addr; a < addr + wmap_region->length; a += PGSIZE)
-      {
-        if ((pte = walkpgdir(curproc->pgdir, (void *)a, 0)) != 0 && (*pte & PTE_P)) // Maybe PTE_P
-        {
-          char *v = P2V(PTE_ADDR(*pte));
-          if (wmap_region->ref_count == 1) // Only free the physical memory if no other process is using it
+          // Write the memory data back to the file
+          int written = filewrite(f, (char *)addr, wmap_region->length);
+          if (written != wmap_region->length)
           {
-            kfree(v);
+            fileclose(f);
+            return -1; // Writing the memory data back to the file failed
           }
-          *pte = 0;
+
+          f->off = temp;
+          fileclose(f);
         }
       }
 
-      // free wmap region if no other process is using it
-      if (wmap_region->ref_count == 0)
+      // Drop this process's reference; the last one frees the
+      // physical memory and the region.  Private regions are never
+      // shared (fork gives the child its own).
+      last = wmaprelease(wmap_region);
+      unmaprange(curproc->pgdir, addr, addr + wmap_region->length, last);
+      if (last)
       {
-        // Free the physical memory and remove the wmap_region
-        kfree((char *)wmap_region);
+        kmem_cache_free(wmap_region);
       }
-      curproc->wmap_regions[i] = 0;
+      curproc->sh->wmap_regions[i] = 0;
       return 0;
     }
   }
@@ -590,7 +966,7 @@ struct wmap_region *find_wmap_region(struct proc *curproc, uint addr)
   int i;
   for (i = 0; i < 16; i++)
   {
-    wmap_region = curproc->wmap_regions[i];
+    wmap_region = curproc->sh->wmap_regions[i];
     if (wmap_region != 0 && wmap_region->addr == addr)
     {
       return wmap_region;
@@ -671,16 +1047,8 @@ int can_shrink_wmap_region(struct proc *curproc, struct wmap_region *region, int
 void shrink_wmap_region(struct proc *curproc, struct wmap_region *region, int newsize)
 {
   // Free the physical memory
-  for (uint a = region->addr + newsize; a < region->addr + region->length; a += PGSIZE)
-  {
-    pte_t *pte = walkpgdir(curproc->pgdir, (void *)a, 0);
-    if (pte && (*pte & PTE_P))
-    {
-      char *v = P2V(PTE_ADDR(*pte));
-      kfree(v);
-      *pte = 0;
-    }
-  }
+  unmaprange(curproc->pgdir, PGROUNDUP(region->addr + newsize),
+             region->addr + region->length, 1);
 
   // Update the wmap_region
   // print region info
@@ -731,16 +1099,7 @@ void move_wmap_region(struct proc *curproc, struct wmap_region *region, uint new
   }
 
   // Free the physical memory and remove the old wmap_region
-  for (uint a = region->addr; a < region->addr + region->length; a += PGSIZE)
-  {
-    pte_t *pte = walkpgdir(curproc->pgdir, (void *)a, 0);
-    if (pte && (*pte & PTE_P))
-    {
-      char *v = P2V(PTE_ADDR(*pte));
-      kfree(v);
-      *pte = 0;
-    }
-  }
+  unmaprange(curproc->pgdir, region->addr, region->addr + region->length, 1);
 
   // Update the wmap_region
   region->addr = newaddr;
@@ -750,6 +1109,7 @@ void move_wmap_region(struct proc *curproc, struct wmap_region *region, uint new
 /**
  * wremap is used to grow or shrink an existing mapping. The existing mapping can be modified in-place, or moved to a new address depending on the flags: If flags is 0, then wremap tries to grow/shrink the mapping in-place, and fails if there's not enough space. If MREMAP_MAYMOVE flag is set, then wremap should also try allocating the requested newsize by moving the mapping. Note that you're allowed to move the mapping only if you can't grow it in-place.
 If wremap fails, the existing mapping should be left intact. In other words, you should only remove the old mapping after the new one succeeds.
+The caller holds myproc()->sh->lock.
  *
  * @param oldaddr
  * @param oldsize
@@ -832,7 +1192,7 @@ int getwmapinfo(struct wmapinfo *wminfo)
   int count = 0;
   for (int i = 0; i < 16; i++)
   {
-    struct wmap_region *wmap_region = curproc->wmap_regions[i];
+    struct wmap_region *wmap_region = curproc->sh->wmap_regions[i];
     if (wmap_region != 0)
     {
       wminfo->addr[count] = wmap_region->addr;
@@ -847,6 +1207,25 @@ int getwmapinfo(struct wmapinfo *wminfo)
   return 0;
 }
 
+// Count the pages of p's heap, and how many are resident.
+void heapstat(struct proc *p, struct memstat *st)
+{
+  pte_t *pte;
+  uint a;
+
+  st->heap_reserved = 0;
+  if (p->sh->sz > p->heapbase)
+    st->heap_reserved = (PGROUNDUP(p->sh->sz) - PGROUNDUP(p->heapbase)) / PGSIZE;
+  st->heap_resident = 0;
+  for (a = PGROUNDUP(p->heapbase); a < p->sh->sz; a += PGSIZE)
+  {
+    if ((pte = walkpgdir(p->pgdir, (char *)a, 0)) == 0)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;  // no page table here
+    else if (*pte & PTE_P)
+      st->heap_resident++;
+  }
+}
+
 int getpgdirinfo(struct pgdirinfo *pdinfo)
 {
   struct proc *curproc = myproc();